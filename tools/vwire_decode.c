@@ -0,0 +1,515 @@
+/*
+ * vwire_decode - offline decoder for captures of the raw receiver samples
+ *
+ * Runs the PLL of the protocol core over captures as debugfs
+ * vwire/capture streams them or vwire_sim -c writes them, and prints the
+ * messages found with their checksum status and quality, and statistics
+ * for each file.  The captures of all the files go to a pool of threads,
+ * each decoding on a channel of its own, so hours of recordings take
+ * minutes.  A long capture is split into pieces of DEC_CHUNK_WORDS or so,
+ * at a quiet spot if there is one nearby.  Each piece is decoded from a
+ * little before its start, for the PLL to lock, to a little after its end,
+ * until no message is in progress, and only reports the messages whose
+ * start symbol began inside it: every message is reported once, wherever
+ * the splits fall.
+ *
+ * Headerless files of sample words from other recorders are read with -r,
+ * -o and -b then say how they were sampled.  Either way the words are in
+ * the byte order of the machine that wrote them.
+ *
+ * Build with "make decode", then run tools/vwire_decode -h for the options.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "vwire_port.h"
+#include "vwire_config.h"
+#include "vwire.h"
+#include "vwire_codec.h"
+#include "vwire_uapi.h"
+
+#define DEC_HDR_WORDS      (sizeof(struct vwire_capture_hdr) / sizeof(uint32_t))
+
+/* words a piece of a long capture should have, about 2 minutes at 2000
+ * baud and 8 samples per bit */
+#define DEC_CHUNK_WORDS    (1u << 16)
+
+/* how far past the nominal split to look for a quiet spot */
+#define DEC_QUIET_SEARCH   (1u << 10)
+
+/* bit times without a transition that count as quiet, longer than any
+ * run inside a message */
+#define DEC_QUIET_BITS     (12)
+
+/* words decoded before and at least after a piece, more than the 12 bits
+ * of a start symbol at 16 samples per bit */
+#define DEC_LEAD_WORDS     (16)
+
+struct dec_stats {
+   uint64_t samples;
+   uint64_t start;          /* start symbols */
+   uint64_t good;
+   uint64_t bad_crc;
+   uint64_t length_err;     /* dropped for an impossible length */
+   double   seconds;        /* of samples */
+};
+
+struct dec_file {
+   const char       *path;
+   const uint32_t   *map;
+   size_t            words;
+   unsigned int      shots;
+   struct dec_stats  stats;
+};
+
+struct dec_frame {
+   uint64_t sample;         /* where its start symbol began, in the shot */
+   uint8_t  crc_ok;
+   uint8_t  quality;
+   uint8_t  len;
+   uint8_t  buf[VW_MAX_PAYLOAD];
+};
+
+/* One piece of work: the words start to end of the shot of len words at
+ * data, and what was found in them */
+struct dec_unit {
+   struct dec_file  *file;
+   unsigned int      shot;
+   const uint32_t   *data;
+   size_t            len;
+   size_t            start;
+   size_t            end;
+   unsigned int      spb;
+   uint64_t          ts_ns;  /* of the first sample of the shot, 0 if unknown */
+   uint32_t          sample_ns;
+
+   struct dec_frame *frame;
+   unsigned int      frames;
+   unsigned int      frames_max;
+   struct dec_stats  stats;
+};
+
+/* Where the decoding channel of a unit is, ch->priv */
+struct dec_ctx {
+   struct dec_unit  *unit;
+   uint64_t          base;   /* sample of the shot the channel started at */
+};
+
+static struct dec_unit *dec_units;
+static unsigned int dec_unit_count;
+static unsigned int dec_unit_max;
+static unsigned int dec_next_unit;
+static int dec_quiet_output;
+
+/* --- decoding */
+
+/* Sample of the shot the PLL counted as clock, which may be a little
+ * before it started */
+static uint64_t dec_sample(const struct dec_ctx *ctx, uint32_t clock)
+{
+   int64_t sample = (int64_t)ctx->base + (int32_t)clock;
+
+   return sample > 0 ? sample : 0;
+}
+
+static int dec_owned(const struct dec_unit *u, uint64_t sample)
+{
+   return sample >= (uint64_t)u->start * 32 && sample < (uint64_t)u->end * 32;
+}
+
+/* Timestamps count samples of the shot, vw_rx_meta() then gives the start
+ * of the start symbol */
+static uint64_t dec_stamp(struct vw_channel *ch, uint32_t samples_ago)
+{
+   return dec_sample(ch->priv, ch->rx_clock - samples_ago);
+}
+
+static void dec_tap(struct vw_channel *ch, uint32_t samples, unsigned int count)
+{
+}
+
+static void dec_event(struct vw_channel *ch, unsigned int event)
+{
+   struct dec_ctx *ctx = ch->priv;
+
+   /* the start symbol began 12 bits ago, a rejected message at its start */
+   if (event == VW_RX_TAP_START) {
+      if (dec_owned(ctx->unit, dec_sample(ctx, ch->rx_clock - 12 * ch->samples_per_bit)))
+         ctx->unit->stats.start++;
+   }
+   else if (event == VW_RX_TAP_LENGTH_REJECT) {
+      if (dec_owned(ctx->unit, dec_sample(ctx, ch->rx_start_clock)))
+         ctx->unit->stats.length_err++;
+   }
+}
+
+static void dec_take(struct dec_unit *u, struct vw_channel *ch, struct vw_rx_cursor *cur)
+{
+   struct vw_rx_meta meta;
+   struct dec_frame *f;
+   uint8_t buf[VW_MAX_PAYLOAD], len;
+
+   while (vw_rx_cursor_have(ch, cur)) {
+      len = sizeof(buf);
+      vw_rx_cursor_get(ch, cur, buf, &len, &meta);
+      if (!dec_owned(u, meta.time_ns))
+         continue;
+
+      if (meta.crc_ok)
+         u->stats.good++;
+      else
+         u->stats.bad_crc++;
+      if (dec_quiet_output)
+         continue;
+
+      if (u->frames == u->frames_max) {
+         u->frames_max = u->frames_max ? u->frames_max * 2 : 64;
+         u->frame = realloc(u->frame, u->frames_max * sizeof(*u->frame));
+         if (!u->frame) {
+            perror("vwire_decode");
+            exit(1);
+         }
+      }
+      f = &u->frame[u->frames++];
+      f->sample = meta.time_ns;
+      f->crc_ok = meta.crc_ok;
+      f->quality = meta.quality;
+      f->len = len;
+      memcpy(f->buf, buf, len);
+   }
+}
+
+static void dec_run(struct dec_unit *u)
+{
+   struct vw_channel *ch = calloc(1, sizeof(*ch));
+   struct vw_rx_cursor cur;
+   struct dec_ctx ctx;
+   size_t w, first, stop;
+
+   if (!ch) {
+      perror("vwire_decode");
+      exit(1);
+   }
+
+   first = u->start > DEC_LEAD_WORDS ? u->start - DEC_LEAD_WORDS : 0;
+   stop = u->len - u->end > DEC_LEAD_WORDS ? u->end + DEC_LEAD_WORDS : u->len;
+   ctx.unit = u;
+   ctx.base = (uint64_t)first * 32;
+
+   vw_init(ch, 0);
+   vw_set_samples_per_bit(ch, u->spb);
+   vw_set_rx_timestamp(ch, dec_stamp);
+   vw_set_rx_tap(ch, dec_tap, dec_event);
+   ch->priv = &ctx;
+   vw_rx_start(ch);
+   vw_rx_cursor_init(ch, &cur);
+
+   /* past the end until the message there is finished */
+   for (w = first; w < u->len; w++) {
+      if (w >= stop && !vw_rx_in_progress(ch))
+         break;
+      vw_pll_word(ch, u->data[w], 32);
+      dec_take(u, ch, &cur);
+   }
+
+   u->stats.samples = (uint64_t)(u->end - u->start) * 32;
+   u->stats.seconds = u->stats.samples * u->sample_ns * 1e-9;
+   free(ch);
+}
+
+static void *dec_worker(void *arg)
+{
+   unsigned int i;
+
+   while ((i = __atomic_fetch_add(&dec_next_unit, 1, __ATOMIC_RELAXED)) < dec_unit_count)
+      dec_run(&dec_units[i]);
+   return NULL;
+}
+
+/* --- splitting the files into units */
+
+static int dec_quiet_word(uint32_t w)
+{
+   return w == 0 || w == 0xffffffff;
+}
+
+/* A split point at or shortly after from, in the middle of the first quiet
+ * spot if there is one, else from itself */
+static size_t dec_split(const uint32_t *data, size_t from, size_t len, unsigned int spb)
+{
+   size_t need = (DEC_QUIET_BITS * spb + 31) / 32 + 1;
+   size_t end = from + DEC_QUIET_SEARCH < len ? from + DEC_QUIET_SEARCH : len;
+   size_t w, run = 0;
+
+   for (w = from; w < end; w++) {
+      if (!dec_quiet_word(data[w]))
+         run = 0;
+      else if (run && data[w] != data[w - 1])
+         run = 1;
+      else if (++run >= need)
+         return w + 1 - run / 2;
+   }
+   return from;
+}
+
+static void dec_add_unit(const struct dec_unit *u)
+{
+   if (dec_unit_count == dec_unit_max) {
+      dec_unit_max = dec_unit_max ? dec_unit_max * 2 : 256;
+      dec_units = realloc(dec_units, dec_unit_max * sizeof(*dec_units));
+      if (!dec_units) {
+         perror("vwire_decode");
+         exit(1);
+      }
+   }
+   dec_units[dec_unit_count++] = *u;
+}
+
+/* All of one shot, in pieces if it is long */
+static void dec_add_shot(struct dec_unit *u)
+{
+   size_t start = 0, end;
+
+   while (start < u->len) {
+      end = u->len - start > DEC_CHUNK_WORDS + DEC_QUIET_SEARCH
+         ? dec_split(u->data, start + DEC_CHUNK_WORDS, u->len, u->spb) : u->len;
+      u->start = start;
+      u->end = end;
+      dec_add_unit(u);
+      start = end;
+   }
+}
+
+static int dec_add_file(struct dec_file *f, unsigned int raw_spb, uint32_t raw_sample_ns)
+{
+   const struct vwire_capture_hdr *hdr;
+   struct dec_unit u;
+   size_t at = 0;
+
+   memset(&u, 0, sizeof(u));
+   u.file = f;
+
+   if (raw_spb) {
+      u.data = f->map;
+      u.len = f->words;
+      u.spb = raw_spb;
+      u.sample_ns = raw_sample_ns;
+      f->shots = 1;
+      dec_add_shot(&u);
+      return 0;
+   }
+
+   while (at < f->words) {
+      hdr = (const struct vwire_capture_hdr *)(f->map + at);
+      if (f->words - at < DEC_HDR_WORDS || hdr->magic != VWIRE_CAPTURE_MAGIC) {
+         fprintf(stderr, "%s: no capture at byte %zu%s\n", f->path, at * sizeof(uint32_t),
+               at ? "" : ", -r for a file of samples only");
+         return -1;
+      }
+      if (hdr->spb < VW_RX_SAMPLES_PER_BIT_MIN || hdr->spb > VW_RX_SAMPLES_PER_BIT_MAX) {
+         fprintf(stderr, "%s: capture %u has %u samples per bit\n", f->path, f->shots, hdr->spb);
+         return -1;
+      }
+
+      u.shot = f->shots++;
+      u.data = f->map + at + DEC_HDR_WORDS;
+      u.len = f->words - at - DEC_HDR_WORDS;
+      if (u.len < hdr->words)
+         fprintf(stderr, "%s: capture %u cut short\n", f->path, u.shot);
+      else
+         u.len = hdr->words;
+      u.spb = hdr->spb;
+      u.ts_ns = hdr->ts_ns;
+      u.sample_ns = hdr->sample_ns;
+      dec_add_shot(&u);
+
+      at += DEC_HDR_WORDS + u.len;
+   }
+   return 0;
+}
+
+static int dec_map_file(struct dec_file *f)
+{
+   struct stat st;
+   void *map;
+   int fd;
+
+   fd = open(f->path, O_RDONLY);
+   if (fd < 0 || fstat(fd, &st)) {
+      perror(f->path);
+      if (fd >= 0)
+         close(fd);
+      return -1;
+   }
+
+   f->words = st.st_size / sizeof(uint32_t);
+   if (f->words) {
+      map = mmap(NULL, f->words * sizeof(uint32_t), PROT_READ, MAP_PRIVATE, fd, 0);
+      if (map == MAP_FAILED) {
+         perror(f->path);
+         close(fd);
+         return -1;
+      }
+      madvise(map, f->words * sizeof(uint32_t), MADV_SEQUENTIAL);
+      f->map = map;
+   }
+   close(fd);
+   return 0;
+}
+
+/* --- output */
+
+static void dec_add_stats(struct dec_stats *to, const struct dec_stats *from)
+{
+   to->samples += from->samples;
+   to->start += from->start;
+   to->good += from->good;
+   to->bad_crc += from->bad_crc;
+   to->length_err += from->length_err;
+   to->seconds += from->seconds;
+}
+
+static void dec_print_frame(const struct dec_unit *u, const struct dec_frame *f)
+{
+   double t = (u->ts_ns + (double)f->sample * u->sample_ns) * 1e-9;
+   unsigned int i;
+
+   printf("%s %u %.6f %s %3u %2u ", u->file->path, u->shot, t,
+         f->crc_ok ? "ok " : "bad", f->quality, f->len);
+   for (i = 0; i < f->len; i++)
+      printf("%02x", f->buf[i]);
+   printf("\n");
+}
+
+/* Start symbols that led to neither a message nor a length reject ran
+ * into an invalid symbol or the end of the capture */
+static void dec_print_stats(const char *name, unsigned int shots, const struct dec_stats *st)
+{
+   printf("%s: %u captures, %.1f s, %llu starts, %llu good, %llu bad crc, "
+         "%llu bad length, %llu lost\n", name, shots, st->seconds,
+         (unsigned long long)st->start, (unsigned long long)st->good,
+         (unsigned long long)st->bad_crc, (unsigned long long)st->length_err,
+         (unsigned long long)(st->start - st->good - st->bad_crc - st->length_err));
+}
+
+static double dec_clock_s(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void dec_usage(const char *prog)
+{
+   fprintf(stderr,
+         "usage: %s [options] file...\n"
+         "  -j threads   decoding threads (one per CPU)\n"
+         "  -q           statistics only, no messages\n"
+         "  -r           the files hold samples only, no capture headers\n"
+         "  -o spb       samples per bit of those, %d to %d (%d)\n"
+         "  -b baud      baud rate of those (%d)\n"
+         "Each message is printed as: file, capture, time in s, checksum ok or bad,\n"
+         "quality, length and the bytes in hex\n",
+         prog, VW_RX_SAMPLES_PER_BIT_MIN, VW_RX_SAMPLES_PER_BIT_MAX,
+         VW_RX_SAMPLES_PER_BIT, VWIRE_DEFAULT_BAUD_RATE);
+}
+
+int main(int argc, char **argv)
+{
+   long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+   unsigned int threads = cpus > 0 ? cpus : 1;
+   unsigned int spb = VW_RX_SAMPLES_PER_BIT, baud = VWIRE_DEFAULT_BAUD_RATE;
+   unsigned int i, j, nfiles, shots = 0;
+   struct dec_file *files;
+   struct dec_stats total;
+   pthread_t *tid;
+   double t0, wall;
+   int raw = 0, opt, err = 0;
+
+   while ((opt = getopt(argc, argv, "j:qro:b:h")) != -1) {
+      switch (opt) {
+      case 'j': threads = strtoul(optarg, NULL, 0); break;
+      case 'q': dec_quiet_output = 1; break;
+      case 'r': raw = 1; break;
+      case 'o': spb = strtoul(optarg, NULL, 0); break;
+      case 'b': baud = strtoul(optarg, NULL, 0); break;
+      default:
+         dec_usage(argv[0]);
+         return opt == 'h' ? 0 : 1;
+      }
+   }
+
+   nfiles = argc - optind;
+   if (nfiles == 0 || threads == 0 || spb < VW_RX_SAMPLES_PER_BIT_MIN
+         || spb > VW_RX_SAMPLES_PER_BIT_MAX || baud < BAUD_MIN || baud > BAUD_MAX) {
+      dec_usage(argv[0]);
+      return 1;
+   }
+
+   vw_codec_init();
+
+   files = calloc(nfiles, sizeof(*files));
+   if (!files) {
+      perror("vwire_decode");
+      return 1;
+   }
+   for (i = 0; i < nfiles; i++) {
+      files[i].path = argv[optind + i];
+      if (dec_map_file(&files[i])
+            || dec_add_file(&files[i], raw ? spb : 0, DelayFromBaudrate(baud, spb)))
+         err = 1;
+   }
+
+   t0 = dec_clock_s();
+   if (threads > dec_unit_count)
+      threads = dec_unit_count ? dec_unit_count : 1;
+   tid = calloc(threads, sizeof(*tid));
+   if (!tid) {
+      perror("vwire_decode");
+      return 1;
+   }
+   for (i = 0; i < threads; i++) {
+      errno = pthread_create(&tid[i], NULL, dec_worker, NULL);
+      if (errno) {
+         perror("pthread_create");
+         return 1;
+      }
+   }
+   for (i = 0; i < threads; i++)
+      pthread_join(tid[i], NULL);
+   wall = dec_clock_s() - t0;
+
+   /* the units are in file order, and in order within each file */
+   for (i = 0; i < dec_unit_count; i++) {
+      struct dec_unit *u = &dec_units[i];
+
+      for (j = 0; j < u->frames; j++)
+         dec_print_frame(u, &u->frame[j]);
+      dec_add_stats(&u->file->stats, &u->stats);
+      free(u->frame);
+   }
+
+   memset(&total, 0, sizeof(total));
+   for (i = 0; i < nfiles; i++) {
+      dec_print_stats(files[i].path, files[i].shots, &files[i].stats);
+      dec_add_stats(&total, &files[i].stats);
+      shots += files[i].shots;
+   }
+   if (nfiles > 1)
+      dec_print_stats("total", shots, &total);
+   printf("decoded in %.2f s with %u threads, %.0f times real time\n",
+         wall, threads, wall > 0 ? total.seconds / wall : 0);
+
+   return err;
+}
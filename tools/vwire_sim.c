@@ -0,0 +1,514 @@
+/*
+ * vwire_sim - software loopback lab for the VirtualWire protocol core
+ *
+ * Wires the transmitter of one channel into the receiver of a second one
+ * through a simulated radio link and reports, for each baud rate, the 
+ * packet error rate, the goodput and the CPU time the receiver spent per 
+ * frame.  The link can flip samples, run the two ends on skewed clocks, 
+ * delay each receive sample by a random timer latency and drop out for a 
+ * while, all repeatable from a seed.  With -w the receiver runs in
+ * deferred mode: vw_int_handler() packs the samples into words and 
+ * vw_rx_decode() runs the PLL over them, as the kernel worker does.
+ * With -c the samples the receiver took are also written out, one
+ * capture per baud rate, for tools/vwire_decode.  With -V a second 
+ * receiver runs vw_pll() on the same samples as the deferred one and the
+ * run stops at the first place the two PLLs disagree.
+ *
+ * Build with "make sim", then run tools/vwire_sim -h for the options.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "vwire_port.h"
+#include "vwire_config.h"
+#include "vwire.h"
+#include "vwire_codec.h"
+#include "vwire_uapi.h"
+
+#define SIM_TX_GPIO     1
+#define SIM_RX_GPIO     2
+#define SIM_BAUD_STEP   1000
+#define SIM_BATCH       4096    /* receiver samples timed at once */
+
+struct sim_params {
+   unsigned int   frames;        /* frames sent per baud rate */
+   unsigned int   spb;           /* samples per bit at both ends */
+   int            word;          /* decode 32 samples at a time */
+   int            verify;        /* check the word PLL against vw_pll() */
+   double         noise;         /* probability a receive sample is flipped */
+   double         skew_ppm;      /* transmitter clock error */
+   double         jitter_ns;     /* receive samples are late by up to this */
+   double         dropout_rate;  /* dropouts per second */
+   double         dropout_ns;    /* length of a dropout */
+   unsigned long  seed;
+   FILE          *samples;       /* receiver samples go here, or NULL */
+};
+
+struct sim_result {
+   unsigned int   sent;
+   unsigned int   good;          /* arrived once with the right contents */
+   unsigned int   bad_crc;
+   unsigned int   wrong;         /* FCS fine but not what was sent */
+   unsigned long  good_bytes;
+   double         air_s;         /* simulated time */
+   double         cpu_ns;        /* CPU time of the receiver, vw_int_handler()
+                                  * and vw_rx_decode() */
+   size_t         checked;       /* samples both PLLs agreed on, with -V */
+};
+
+/* --- deterministic random numbers, xorshift64* */
+static uint64_t sim_rng;
+
+static uint64_t sim_rand(void)
+{
+   sim_rng ^= sim_rng >> 12;
+   sim_rng ^= sim_rng << 25;
+   sim_rng ^= sim_rng >> 27;
+   return sim_rng * 0x2545f4914f6cdd1dULL;
+}
+
+/* uniform in [0, 1) */
+static double sim_uniform(void)
+{
+   return (sim_rand() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* --- the radio link, seen by the core through its GPIO calls */
+static int sim_wire;        /* level the transmitter drives */
+static int sim_rx_level;    /* level the receiver reads on this sample */
+
+static int sim_gpio_get(void *ctx, unsigned gpio)
+{
+   return gpio == SIM_RX_GPIO ? sim_rx_level : 0;
+}
+
+static void sim_gpio_set(void *ctx, unsigned gpio, int value)
+{
+   if (gpio == SIM_TX_GPIO)
+      sim_wire = !!value;
+}
+
+static const struct vw_port_gpio_ops sim_gpio_ops = {
+   .get = sim_gpio_get,
+   .set = sim_gpio_set,
+};
+
+/* deferred mode: set when a word of samples is waiting for vw_rx_decode() */
+static int sim_capture_ready;
+
+static void sim_capture_callback(struct vw_channel *ch)
+{
+   sim_capture_ready = 1;
+}
+
+/* -c: the receiver samples, as debugfs vwire/capture writes them */
+static FILE *sim_samples_file;
+static uint32_t sim_samples_word;
+static unsigned int sim_samples_bits;
+static uint32_t sim_samples_words;
+
+static void sim_samples_tap(struct vw_channel *ch, uint32_t samples, unsigned int count)
+{
+   unsigned int room = 32 - sim_samples_bits;
+
+   if (count < 32)
+      samples &= (1u << count) - 1;
+   sim_samples_word |= samples << sim_samples_bits;
+   if (count < room) {
+      sim_samples_bits += count;
+      return;
+   }
+
+   fwrite(&sim_samples_word, sizeof(sim_samples_word), 1, sim_samples_file);
+   sim_samples_words++;
+   sim_samples_word = room < 32 ? samples >> room : 0;
+   sim_samples_bits = count - room;
+}
+
+/* The header goes in front of the samples once their number is known */
+static void sim_samples_header(const struct vw_channel *ch, long at, double sample_ns)
+{
+   struct vwire_capture_hdr hdr;
+   long end = ftell(sim_samples_file);
+
+   memset(&hdr, 0, sizeof(hdr));
+   hdr.magic = VWIRE_CAPTURE_MAGIC;
+   hdr.chan = ch->id;
+   hdr.spb = ch->samples_per_bit;
+   hdr.words = sim_samples_words;
+   hdr.sample_ns = sample_ns;
+
+   fseek(sim_samples_file, at, SEEK_SET);
+   fwrite(&hdr, sizeof(hdr), 1, sim_samples_file);
+   fseek(sim_samples_file, end, SEEK_SET);
+}
+
+/* CPU time of this thread.  A receiver sample costs about as much as
+ * reading the clock, so only whole batches of them are timed */
+static double sim_cpu_ns(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+   return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* The levels the receiver is to read, one bit each, so that the link 
+ * can be simulated first and the receiver timed on its own afterwards */
+struct sim_levels {
+   unsigned char  *bits;
+   size_t         count;
+   size_t         size;
+};
+
+static void sim_levels_put(struct sim_levels *lv, int level)
+{
+   size_t old = lv->size;
+
+   if (lv->count / 8 >= old) {
+      lv->size = old ? old * 2 : 65536;
+      lv->bits = realloc(lv->bits, lv->size);
+      if (!lv->bits) {
+         perror("vwire_sim");
+         exit(1);
+      }
+      memset(lv->bits + old, 0, lv->size - old);
+   }
+   if (level)
+      lv->bits[lv->count / 8] |= 1 << (lv->count % 8);
+   lv->count++;
+}
+
+static int sim_levels_get(const struct sim_levels *lv, size_t i)
+{
+   return (lv->bits[i / 8] >> (i % 8)) & 1;
+}
+
+/* Payload of frame seq: the sequence number then bytes derived from it,
+ * so the receiver can check what arrived without keeping copies */
+static uint8_t sim_make_frame(unsigned int seq, uint8_t *buf)
+{
+   uint8_t len = 2 + seq % (VW_MAX_PAYLOAD - 1);
+   uint8_t i;
+
+   buf[0] = seq;
+   buf[1] = seq >> 8;
+   for (i = 2; i < len; i++)
+      buf[i] = (seq * 31 + i * 7) ^ 0x5a;
+   return len;
+}
+
+/* -V: fail unless the word PLL of rx is where vw_pll() got ref to, after
+ * sample i */
+static void sim_verify_pll(const struct vw_channel *rx, const struct vw_channel *ref, 
+                           size_t i)
+{
+   const char *what = NULL;
+
+   if (rx->rx_pll_ramp != ref->rx_pll_ramp)
+      what = "ramp";
+   else if (rx->rx_integrator != ref->rx_integrator)
+      what = "integrator";
+   else if (rx->rx_clock != ref->rx_clock)
+      what = "rx_clock";
+   else if (rx->rx_bits != ref->rx_bits)
+      what = "bits received";
+   if (!what)
+      return;
+
+   printf("word PLL and vw_pll() differ in %s after sample %zu: ramp %u/%u, integrator %u/%u, rx_clock %u/%u, bits %#x/%#x\n",
+         what, i, rx->rx_pll_ramp, ref->rx_pll_ramp, rx->rx_integrator, ref->rx_integrator,
+         rx->rx_clock, ref->rx_clock, rx->rx_bits, ref->rx_bits);
+   exit(1);
+}
+
+/* -V: fail unless ref decoded the frame rx just did, ok and len are what
+ * vw_get_message() said of it on rx */
+static void sim_verify_frame(struct vw_channel *ref, uint8_t ok, const uint8_t *buf, 
+                             uint8_t len, unsigned long frame)
+{
+   uint8_t rbuf[VW_MAX_PAYLOAD], rlen = sizeof(rbuf), rok;
+
+   if (!vw_have_message(ref)) {
+      printf("word PLL decoded frame %lu, vw_pll() did not\n", frame);
+      exit(1);
+   }
+   rok = vw_get_message(ref, rbuf, &rlen);
+   if (rok != ok || rlen != len || memcmp(rbuf, buf, len)) {
+      printf("word PLL and vw_pll() decoded frame %lu differently\n", frame);
+      exit(1);
+   }
+}
+
+static void sim_check_frames(struct vw_channel *rx, struct vw_channel *ref,
+                             struct sim_result *res, unsigned char *seen)
+{
+   uint8_t buf[VW_MAX_PAYLOAD], expect[VW_MAX_PAYLOAD];
+   uint8_t len, elen, ok;
+   unsigned int seq;
+
+   while (vw_have_message(rx)) {
+      len = sizeof(buf);
+      ok = vw_get_message(rx, buf, &len);
+      if (ref)
+         sim_verify_frame(ref, ok, buf, len, res->good + res->bad_crc + res->wrong);
+      if (!ok) {
+         res->bad_crc++;
+         continue;
+      }
+      seq = len >= 2 ? buf[0] | (buf[1] << 8) : ~0u;
+      if (seq >= res->sent) {
+         res->wrong++;
+         continue;
+      }
+      elen = sim_make_frame(seq, expect);
+      if (len != elen || memcmp(buf, expect, len)) {
+         res->wrong++;
+         continue;
+      }
+      if (!seen[seq]) {
+         seen[seq] = 1;
+         res->good++;
+         res->good_bytes += len;
+      }
+   }
+   if (ref && vw_have_message(ref)) {
+      printf("vw_pll() decoded frame %u, the word PLL did not\n",
+            res->good + res->bad_crc + res->wrong);
+      exit(1);
+   }
+}
+
+/* Run one baud rate.  Both ends tick from their own clock, the earlier 
+ * event is processed first.  What the receiver reads on each of its ticks
+ * is recorded, then played into it in batches of SIM_BATCH samples, each
+ * timed as a whole and followed by a check of what arrived.  With -V the
+ * reference receiver takes every sample as well, inside the timing. */
+static void sim_run(const struct sim_params *p, unsigned int baud, struct sim_result *res)
+{
+   static struct vw_channel tx, rx, ref;
+   unsigned char *seen = calloc(p->frames, 1);
+   double rx_period = DelayFromBaudrate(baud, p->spb);
+   double tx_period = rx_period * (1.0 + p->skew_ppm * 1e-6);
+   double jitter = p->jitter_ns < rx_period * 0.9 ? p->jitter_ns : rx_period * 0.9;
+   double tx_next = 0, rx_tick = 0, rx_next = 0, dropout_end = -1;
+   double drop_prob = p->dropout_rate * rx_period * 1e-9;
+   double idle_end = -1, t0;
+   uint8_t buf[VW_MAX_PAYLOAD], len;
+   unsigned int next_seq = 0;
+   struct sim_levels levels = { 0 };
+   size_t i, end;
+   long samples_at = 0;
+
+   memset(&tx, 0, sizeof(tx));
+   memset(&rx, 0, sizeof(rx));
+   memset(&ref, 0, sizeof(ref));
+   memset(res, 0, sizeof(*res));
+   sim_wire = 0;
+
+   vw_init(&tx, 0);
+   vw_set_samples_per_bit(&tx, p->spb);
+   vw_set_tx_pin(&tx, SIM_TX_GPIO);
+   vw_setup(&tx);
+
+   vw_init(&rx, 1);
+   vw_set_samples_per_bit(&rx, p->spb);
+   vw_set_rx_pin(&rx, SIM_RX_GPIO);
+   vw_setup(&rx);
+   /* decoded right after each word in deferred mode */
+   vw_set_rx_deferred(&rx, p->word, sim_capture_callback);
+   if (p->samples) {
+      struct vwire_capture_hdr hdr = { 0 };
+
+      sim_samples_file = p->samples;
+      sim_samples_word = 0;
+      sim_samples_bits = 0;
+      sim_samples_words = 0;
+      samples_at = ftell(p->samples);
+      fwrite(&hdr, sizeof(hdr), 1, p->samples);
+      vw_set_rx_tap(&rx, sim_samples_tap, NULL);
+   }
+   vw_rx_start(&rx);
+
+   /* the same pin, sampled by the same vw_int_handler() calls */
+   if (p->verify) {
+      vw_init(&ref, 2);
+      vw_set_samples_per_bit(&ref, p->spb);
+      vw_set_rx_pin(&ref, SIM_RX_GPIO);
+      vw_setup(&ref);
+      vw_rx_start(&ref);
+   }
+
+   for (;;) {
+      /* keep the transmit queue fed until every frame is out */
+      while (next_seq < p->frames && !vw_tx_queue_full(&tx)) {
+         len = sim_make_frame(next_seq++, buf);
+         vw_send(&tx, buf, len);
+      }
+      res->sent = next_seq;
+
+      /* then give the receiver a few bit times to finish */
+      if (next_seq == p->frames && !vx_tx_active(&tx) && !vw_tx_queue_count(&tx)) {
+         if (idle_end < 0)
+            idle_end = tx_next + 32 * 8 * rx_period;
+         else if (rx_next > idle_end)
+            break;
+      }
+
+      if (tx_next <= rx_next) {
+         vw_int_handler(&tx);
+         tx_next += tx_period;
+         continue;
+      }
+
+      /* the receiver reads the wire through the link impairments */
+      if (dropout_end < rx_next && drop_prob > 0 && sim_uniform() < drop_prob)
+         dropout_end = rx_next + p->dropout_ns;
+      if (rx_next < dropout_end)
+         sim_levels_put(&levels, 0);
+      else
+         sim_levels_put(&levels, sim_wire ^ (p->noise > 0 && sim_uniform() < p->noise));
+
+      /* the timer is late by the jitter, but does not drift */
+      rx_tick += rx_period;
+      rx_next = rx_tick + sim_uniform() * jitter;
+   }
+   res->air_s = rx_next * 1e-9;
+
+   for (i = 0; i < levels.count; i = end) {
+      end = i + SIM_BATCH < levels.count ? i + SIM_BATCH : levels.count;
+
+      t0 = sim_cpu_ns();
+      for (; i < end; i++) {
+         sim_rx_level = sim_levels_get(&levels, i);
+         vw_int_handler(&rx);
+         if (p->verify)
+            vw_int_handler(&ref);
+         if (sim_capture_ready) {
+            sim_capture_ready = 0;
+            vw_rx_decode(&rx);
+            /* both have taken every sample up to i now */
+            if (p->verify)
+               sim_verify_pll(&rx, &ref, i);
+         }
+      }
+      res->cpu_ns += sim_cpu_ns() - t0;
+
+      sim_check_frames(&rx, p->verify ? &ref : NULL, res, seen);
+   }
+   if (p->verify)
+      res->checked = levels.count;
+
+   if (p->samples)
+      sim_samples_header(&rx, samples_at, rx_period);
+
+   vw_shutdown(&tx);
+   vw_shutdown(&rx);
+   if (p->verify)
+      vw_shutdown(&ref);
+   free(levels.bits);
+   free(seen);
+}
+
+static void sim_usage(const char *prog)
+{
+   fprintf(stderr,
+         "usage: %s [options]\n"
+         "  -n frames    frames sent per baud rate (1000)\n"
+         "  -b baud      only this baud rate, default %d to %d in steps of %d\n"
+         "  -o spb       samples per bit, %d, %d or %d (%d)\n"
+         "  -w           deferred decoding, 32 samples at a time\n"
+         "  -V           as -w, and fail where it differs from vw_pll()\n"
+         "  -e prob      probability a receive sample is flipped (0)\n"
+         "  -s ppm       transmitter clock skew (0)\n"
+         "  -j ns        receive timer latency, uniform up to this (0)\n"
+         "  -d rate      dropouts per second (0)\n"
+         "  -D us        length of a dropout (1000)\n"
+         "  -S seed      random seed (1)\n"
+         "  -c file      write the receiver samples to file, for vwire_decode\n",
+         prog, BAUD_MIN, BAUD_MAX, SIM_BAUD_STEP, VW_RX_SAMPLES_PER_BIT_MIN,
+         VW_RX_SAMPLES_PER_BIT, VW_RX_SAMPLES_PER_BIT_MAX, VW_RX_SAMPLES_PER_BIT);
+}
+
+int main(int argc, char **argv)
+{
+   struct sim_params p = {
+      .frames = 1000,
+      .spb = VW_RX_SAMPLES_PER_BIT,
+      .dropout_ns = 1000000,
+      .seed = 1,
+   };
+   struct sim_result res;
+   unsigned int baud, baud_min = BAUD_MIN, baud_max = BAUD_MAX;
+   size_t checked = 0;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "n:b:o:wVe:s:j:d:D:S:c:h")) != -1) {
+      switch (opt) {
+      case 'n': p.frames = strtoul(optarg, NULL, 0); break;
+      case 'b': baud_min = baud_max = strtoul(optarg, NULL, 0); break;
+      case 'o': p.spb = strtoul(optarg, NULL, 0); break;
+      case 'w': p.word = 1; break;
+      case 'V': p.word = p.verify = 1; break;
+      case 'e': p.noise = atof(optarg); break;
+      case 's': p.skew_ppm = atof(optarg); break;
+      case 'j': p.jitter_ns = atof(optarg); break;
+      case 'd': p.dropout_rate = atof(optarg); break;
+      case 'D': p.dropout_ns = atof(optarg) * 1000; break;
+      case 'S': p.seed = strtoul(optarg, NULL, 0); break;
+      case 'c':
+         p.samples = fopen(optarg, "wb");
+         if (!p.samples) {
+            perror(optarg);
+            return 1;
+         }
+         break;
+      default:
+         sim_usage(argv[0]);
+         return opt == 'h' ? 0 : 1;
+      }
+   }
+
+   if (p.frames == 0 || p.frames > 65535 || baud_min < BAUD_MIN || baud_max > BAUD_MAX
+         || (p.spb != VW_RX_SAMPLES_PER_BIT_MIN && p.spb != VW_RX_SAMPLES_PER_BIT
+            && p.spb != VW_RX_SAMPLES_PER_BIT_MAX)) {
+      sim_usage(argv[0]);
+      return 1;
+   }
+
+   /* vw_setup() logs every pin it gets */
+   if (!freopen("/dev/null", "w", stderr))
+      return 1;
+
+   vw_codec_init();
+   vw_port_set_gpio_ops(&sim_gpio_ops);
+
+   printf("frames %u, %u samples per bit%s, noise %g, skew %g ppm, jitter %g ns, dropouts %g/s of %g us, seed %lu\n",
+         p.frames, p.spb, p.word ? ", deferred" : "", p.noise, p.skew_ppm, p.jitter_ns, p.dropout_rate, p.dropout_ns / 1000, p.seed);
+   printf("%6s %8s %8s %8s %8s %8s %10s %12s\n",
+         "baud", "sent", "good", "badcrc", "wrong", "PER", "goodput", "cpu/frame");
+
+   for (baud = baud_min; baud <= baud_max; baud += SIM_BAUD_STEP) {
+      sim_rng = p.seed * 0x9e3779b97f4a7c15ULL + baud;
+      sim_run(&p, baud, &res);
+      printf("%6u %8u %8u %8u %8u %8.4f %6.0f b/s %9.0f ns\n",
+            baud, res.sent, res.good, res.bad_crc, res.wrong,
+            1.0 - (double)res.good / res.sent,
+            res.good_bytes * 8 / res.air_s,
+            res.cpu_ns / res.sent);
+      checked += res.checked;
+   }
+   if (p.verify)
+      printf("word PLL and vw_pll() agree on all %zu samples\n", checked);
+
+   if (p.samples && fclose(p.samples)) {
+      perror("capture");
+      return 1;
+   }
+   return 0;
+}
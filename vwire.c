@@ -10,338 +10,872 @@
 // 30-March-2015
 // GPL2
 
-#include <linux/module.h>
-#include <linux/kernel.h>
-#include <linux/gpio.h>
-#include <linux/jiffies.h>
+#include "vwire_port.h"
 
 #include "vwire_config.h"
 #include "vwire.h"
-#include "crc16.h"
+#include "vwire_codec.h"
 
-/* the receiver device */
-static struct gpio receiver;
+// Training preamble and start symbol sent in front of every message
+static const uint8_t vw_tx_header[VW_HEADER_LEN] = {0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x38, 0x2c};
 
-/* the transmitter device */
-static struct gpio transmitter;
+// Set up a zeroed channel with empty queues of the largest size
+void vw_init(struct vw_channel *ch, uint8_t id)
+{
+   ch->id = id;
+   ch->tx_buf = vw_tx_header;
+   ch->tx_queue_len = VW_TX_QUEUE_MAX;
+   ch->rx_ring = &ch->rx_ring_own;
+   ch->rx_ring->len = VW_RX_QUEUE_MAX;
+   ch->rx_step = 1;
+   u64_stats_init(&ch->rx_syncp);
+   u64_stats_init(&ch->tx_syncp);
+   vw_set_samples_per_bit(ch, VW_RX_SAMPLES_PER_BIT);
+}
 
-/* the ptt device */
-static struct gpio ptt;
+uint8_t vw_set_samples_per_bit(struct vw_channel *ch, uint8_t spb)
+{
+   if (spb != VW_RX_SAMPLES_PER_BIT_MIN && spb != VW_RX_SAMPLES_PER_BIT 
+         && spb != VW_RX_SAMPLES_PER_BIT_MAX)
+      return false;
 
-/* an led (optional) for debugging */
-static struct gpio led;
+   ch->samples_per_bit = spb;
+   ch->rx_ramp_inc = VW_RAMP_INC(spb);
+   ch->rx_ramp_inc_retard = VW_RAMP_INC_RETARD(spb);
+   ch->rx_ramp_inc_advance = VW_RAMP_INC_ADVANCE(spb);
+   // x * rx_ramp_recip >> 16 is x / rx_ramp_inc for any ramp value
+   ch->rx_ramp_recip = (65536 + ch->rx_ramp_inc - 1) / ch->rx_ramp_inc;
+   // more than half of the samples, 5 of 8
+   ch->rx_integrator_threshold = spb / 2 + 1;
+
+   // Start over on the new bit clock
+   ch->rx_pll_ramp = 0;
+   ch->rx_integrator = 0;
+   ch->tx_sample = 0;
+   return true;
+}
 
-static uint8_t vw_tx_buf[(VW_MAX_MESSAGE_LEN * 2) + VW_HEADER_LEN] = {0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x38, 0x2c};
+// Set the output pin number for transmitter data
+void vw_set_tx_pin(struct vw_channel *ch, uint8_t pin)
+{
+   ch->transmitter.gpio = pin;
+}
 
-// Number of symbols in vw_tx_buf to be sent;
-static uint8_t vw_tx_len = 0;
+// Set the pin number for input receiver data
+void vw_set_rx_pin(struct vw_channel *ch, uint8_t pin)
+{
+   ch->receiver.gpio = pin;
+}
 
-// Index of the next symbol to send. Ranges from 0 to vw_tx_len
-static uint8_t vw_tx_index = 0;
+// Set the output pin number for transmitter PTT enable
+void vw_set_ptt_pin(struct vw_channel *ch, uint8_t pin)
+{
+   ch->ptt.gpio = pin;
+}
 
-// Bit number of next bit to send
-static uint8_t vw_tx_bit = 0;
+// Set the ptt pin inverted (low to transmit)
+void vw_set_ptt_inverted(struct vw_channel *ch, uint8_t inverted)
+{
+   ch->ptt_inverted = inverted;
+}
 
-// Sample number for the transmitter. Runs 0 to 7 during one bit interval
-static uint8_t vw_tx_sample = 0;
+// Set the LED status pin 
+void vw_set_led_pin(struct vw_channel *ch, uint8_t pin)
+{
+   ch->led.gpio = pin;
+}
 
-// Flag to indicated the transmitter is active
-static volatile uint8_t vw_tx_enabled = 0;
+// Set the number of received messages kept for the readers
+// Rounded down to a power of 2, at most VW_RX_QUEUE_MAX
+// Discards anything queued, so only call it while the receiver is stopped
+// and before any reader is started
+void vw_set_rx_queue_len(struct vw_channel *ch, unsigned int len)
+{
+   len = Limit(len, 1, VW_RX_QUEUE_MAX);
+   while (len & (len - 1))
+      len &= len - 1;
+
+   ch->rx_ring->len = len;
+   ch->rx_ring->head = 0;
+   memset(ch->rx_ring->frame, 0, sizeof(ch->rx_ring->frame));
+   vw_rx_cursor_init(ch, &ch->rx_reader);
+}
+
+void vw_set_rx_ring(struct vw_channel *ch, struct vw_rx_ring *ring)
+{
+   unsigned int len = ch->rx_ring->len;
+   unsigned int i;
 
-// Total number of messages sent
-static uint16_t vw_tx_msg_count = 0;
+   ch->rx_ring = ring ? ring : &ch->rx_ring_own;
+   vw_set_rx_queue_len(ch, len);
 
-// The digital IO pin number of the press to talk, enables the transmitter hardware
-static uint8_t vw_ptt_inverted = 0;
+   // The other rates queue where the channel does
+   for (i = 0; i < ch->rx_rates; i++)
+      ch->rx_rate[i]->rx_ring = ch->rx_ring;
+}
 
-// Put more debugging info to kernel log
-static uint8_t vw_verbose_debug = 0;
+// Set the functions called when a message arrives and when the transmitter
+// becomes idle, so the caller can wake up readers and writers
+// They run at interrupt level and must not sleep
+void vw_set_callbacks(struct vw_channel *ch,
+                      void (*rx_done)(struct vw_channel *ch),
+                      void (*tx_done)(struct vw_channel *ch))
+{
+   ch->rx_callback = rx_done;
+   ch->tx_callback = tx_done;
+}
 
-// Current receiver sample
-static uint8_t vw_rx_sample = 0;
+// Set the number of encoded messages that can wait to be sent
+// Rounded down to a power of 2, at most VW_TX_QUEUE_MAX
+// Discards anything queued, so only call it while the transmitter is stopped
+void vw_set_tx_queue_len(struct vw_channel *ch, unsigned int len)
+{
+   len = Limit(len, 1, VW_TX_QUEUE_MAX);
+   while (len & (len - 1))
+      len &= len - 1;
 
-// Last receiver sample
-static uint8_t vw_rx_last_sample = 0;
+   ch->tx_queue_len = len;
+   ch->tx_queue_head = 0;
+   ch->tx_queue_tail = 0;
+}
 
-// PLL ramp, varies between 0 and VW_RX_RAMP_LEN-1 (159) over 
-// VW_RX_SAMPLES_PER_BIT (8) samples per nominal bit time. 
-// When the PLL is synchronised, bit transitions happen at about the
-// 0 mark. 
-static uint8_t vw_rx_pll_ramp = 0;
+// Number of messages queued for sending, including the one on the air
+unsigned int vw_tx_queue_count(struct vw_channel *ch)
+{
+   return READ_ONCE(ch->tx_queue_head) - READ_ONCE(ch->tx_queue_tail);
+}
 
-// This is the integrate and dump integral. If there are <5 0 samples in the PLL cycle
-// the bit is declared a 0, else a 1
-static uint8_t vw_rx_integrator = 0;
+// Return true if vw_send() would refuse a message for lack of room
+uint8_t vw_tx_queue_full(struct vw_channel *ch)
+{
+   return vw_tx_queue_count(ch) >= ch->tx_queue_len;
+}
 
-// Flag indictate if we have seen the start symbol of a new message and are
-// in the processes of reading and decoding it
-static uint8_t vw_rx_active = 0;
+// Count one receive event, called from the PLL only
+#define vw_rx_count(ch, field) \
+   do { \
+      u64_stats_update_begin(&(ch)->rx_syncp); \
+      (ch)->stats.field++; \
+      u64_stats_update_end(&(ch)->rx_syncp); \
+   } while (0)
 
-// Flag to indicate that a new message is available
-static volatile uint8_t vw_rx_done = 0;
+// Consistent copy of the counters, even where a 64 bit read is not atomic
+static void vw_read_stats(struct vw_channel *ch, struct vw_stats *st)
+{
+   unsigned int start;
+
+   do {
+      start = u64_stats_fetch_begin(&ch->rx_syncp);
+      st->rx_start = ch->stats.rx_start;
+      st->rx_length_err = ch->stats.rx_length_err;
+      st->rx_symbol_err = ch->stats.rx_symbol_err;
+      st->rx_crc_err = ch->stats.rx_crc_err;
+      st->rx_good = ch->stats.rx_good;
+      st->rx_filtered = ch->stats.rx_filtered;
+      st->rx_duplicate = ch->stats.rx_duplicate;
+   } while (u64_stats_fetch_retry(&ch->rx_syncp, start));
+
+   do {
+      start = u64_stats_fetch_begin(&ch->tx_syncp);
+      st->tx_frames = ch->stats.tx_frames;
+      st->tx_airtime_ns = ch->stats.tx_airtime_ns;
+   } while (u64_stats_fetch_retry(&ch->tx_syncp, start));
+
+   st->tx_full = READ_ONCE(ch->tx_full);
+   st->rx_overflow = READ_ONCE(ch->rx_reader.dropped);
+   st->rx_capture_lost = READ_ONCE(ch->rx_capture_lost);
+}
 
-// Flag to indicate the receiver PLL is to run
-static uint8_t vw_rx_enabled = 0;
+// Counters since the last reset. The running counters are never written
+// by the reader, a reset only moves the baseline
+// The counters of the channel and of its decoders for other rates added
+// up. Only the channel's own can be non zero outside of the receive side
+static void vw_sum_stats(struct vw_channel *ch, struct vw_stats *stats)
+{
+   uint64_t *st = (uint64_t *)stats;
+   const uint64_t *add;
+   struct vw_stats rate;
+   unsigned int i, j;
 
-// Last 12 bits received, so we can look for the start symbol
-static uint16_t vw_rx_bits = 0;
+   vw_read_stats(ch, stats);
+   for (i = 0; i < ch->rx_rates; i++)
+   {
+      vw_read_stats(ch->rx_rate[i], &rate);
+      add = (const uint64_t *)&rate;
+      for (j = 0; j < sizeof(*stats) / sizeof(uint64_t); j++)
+         st[j] += add[j];
+   }
+}
 
-// How many bits of message we have received. Ranges from 0 to 12
-static uint8_t vw_rx_bit_count = 0;
+void vw_get_stats(struct vw_channel *ch, struct vw_stats *stats)
+{
+   const uint64_t *base = (const uint64_t *)&ch->stats_base;
+   uint64_t *st = (uint64_t *)stats;
+   unsigned int i;
 
-// The incoming message buffer
-static uint8_t vw_rx_buf[VW_MAX_MESSAGE_LEN];
+   vw_sum_stats(ch, stats);
+   for (i = 0; i < sizeof(*stats) / sizeof(uint64_t); i++)
+      st[i] -= base[i];
+}
 
-// The incoming message expected length
-static uint8_t vw_rx_count = 0;
+void vw_reset_stats(struct vw_channel *ch)
+{
+   vw_sum_stats(ch, &ch->stats_base);
+}
 
-// The incoming message buffer length received so far
-static volatile uint8_t vw_rx_len = 0;
+void vw_set_tx_bit_time(struct vw_channel *ch, uint32_t ns)
+{
+   ch->tx_bit_ns = ns;
+}
 
-// Number of bad messages received and dropped due to bad lengths
-static uint8_t vw_rx_bad = 0;
+const struct vw_rx_filter *vw_set_rx_filter(struct vw_channel *ch,
+                                            const struct vw_rx_filter *filter)
+{
+   const struct vw_rx_filter *old = rcu_dereference_protected(ch->rx_filter, true);
+   unsigned int i;
 
-// Number of good messages received
-static uint8_t vw_rx_good = 0;
+   rcu_assign_pointer(ch->rx_filter, filter);
+   for (i = 0; i < ch->rx_rates; i++)
+      rcu_assign_pointer(ch->rx_rate[i]->rx_filter, filter);
+   return old;
+}
 
-// 4 bit to 6 bit symbol converter table
-// Used to convert the high and low nybbles of the transmitted data
-// into 6 bit symbols for transmission. Each 6-bit symbol has 3 1s and 3 0s 
-// with at most 3 consecutive identical bits
-static uint8_t symbols[] =
+// True if the payload msg of len bytes matches any rule of filter
+static bool vw_rx_filter_match(const struct vw_rx_filter *filter,
+                               const uint8_t *msg, uint8_t len)
 {
-   0xd,  0xe,  0x13, 0x15, 0x16, 0x19, 0x1a, 0x1c, 
-   0x23, 0x25, 0x26, 0x29, 0x2a, 0x2c, 0x32, 0x34
-};
+   const struct vw_rx_rule *rule;
+   unsigned int i;
 
-// Cant really do this as a real C++ class, since we need to have 
-// an ISR
-// Compute CRC over count bytes.
-// This should only be ever called at user level, not interrupt level
-uint16_t vw_crc(uint8_t *ptr, uint8_t count)
+   for (i = 0; i < filter->count; i++)
+   {
+      rule = &filter->rule[i];
+      if (len < rule->min_len || len > rule->max_len)
+         continue;
+      if (rule->mask && (rule->offset >= len
+               || (msg[rule->offset] & rule->mask) != rule->value))
+         continue;
+      return true;
+   }
+   return false;
+}
+
+void vw_set_rx_dedup(struct vw_channel *ch, unsigned long window)
 {
-   uint16_t crc = 0xffff;
+   unsigned int i;
+
+   WRITE_ONCE(ch->rx_dedup_window, window);
+   for (i = 0; i < ch->rx_rates; i++)
+      WRITE_ONCE(ch->rx_rate[i]->rx_dedup_window, window);
+}
+
+// True if the message in rx_buf arrived less than window ago, otherwise
+// it is remembered for next time. The FCS is as good a hash as any
+static bool vw_rx_duplicate(struct vw_channel *ch, unsigned long window)
+{
+   uint8_t hash = ch->rx_buf[ch->rx_len - 2] ^ ch->rx_buf[ch->rx_len - 1];
+   struct vw_rx_seen *seen = &ch->rx_seen[hash & (VW_RX_DEDUP_SLOTS - 1)];
+   unsigned long now = jiffies;
+
+   if (seen->len == ch->rx_len && now - seen->time < window
+         && !memcmp(seen->buf, ch->rx_buf, ch->rx_len))
+      return true;
+
+   // Newest wins the slot, the window runs from the first copy
+   seen->time = now;
+   seen->len = ch->rx_len;
+   memcpy(seen->buf, ch->rx_buf, ch->rx_len);
+   return false;
+}
+
+void vw_set_rx_timestamp(struct vw_channel *ch,
+                         uint64_t (*stamp)(struct vw_channel *ch, uint32_t samples_ago))
+{
+   ch->rx_timestamp = stamp;
+}
 
-   while (count-- > 0) {
-      crc = _crc_ccitt_update(crc, *ptr++);
+void vw_set_rx_tap(struct vw_channel *ch,
+                   void (*tap)(struct vw_channel *ch, uint32_t samples, unsigned int count),
+                   void (*event)(struct vw_channel *ch, unsigned int event))
+{
+   ch->rx_tap = tap;
+   ch->rx_tap_event = event;
+}
+
+// Tell the receiver tap about event, if anyone is listening
+static inline void vw_rx_tap_event(struct vw_channel *ch, unsigned int event)
+{
+   if (vw_rx_tapped(ch) && ch->rx_tap_event)
+      ch->rx_tap_event(ch, event);
+}
+
+uint64_t vw_rx_sample_time(struct vw_channel *ch, uint32_t clock)
+{
+   uint32_t ago;
+
+   // A decoder for another rate counts every rx_step'th sample of its
+   // channel, time them on the channel's clock
+   if (ch->rx_parent)
+   {
+      clock = ch->rx_parent_clock + clock * ch->rx_step;
+      ch = ch->rx_parent;
    }
-   return crc;
+   ago = ch->rx_clock - clock;
+
+   if (!ch->rx_timestamp)
+      return 0;
+
+   // In deferred mode the samples still waiting in the capture ring were
+   // taken after the ones the PLL has got to
+   if (ch->rx_deferred)
+      ago += READ_ONCE(ch->rx_capture_clock) + READ_ONCE(ch->rx_capture_bits) - ch->rx_clock;
+
+   return ch->rx_timestamp(ch, ago);
 }
 
-// Convert a 6 bit encoded symbol into its 4 bit decoded equivalent
-uint8_t vw_symbol_6to4(uint8_t symbol)
+// Timestamp, FCS and quality of the message in rx_buf, just completed
+static void vw_rx_meta(struct vw_channel *ch, struct vw_rx_meta *meta)
 {
-   uint8_t i;
+   meta->time_ns = vw_rx_sample_time(ch, ch->rx_start_clock);
+   meta->crc_ok = (ch->rx_crc == 0xf0b8); // FCS OK?
+   meta->baud = ch->tx_bit_ns ? (1000000000 + ch->tx_bit_ns / 2) / ch->tx_bit_ns : 0;
+
+   // A transition can be at most half a ramp from the 0 mark
+   meta->quality = 255;
+   if (ch->rx_transitions)
+      meta->quality -= ch->rx_phase_err * 255 / (ch->rx_transitions * (VW_RX_RAMP_LEN / 2));
+}
+
+// Append the message in ch->rx_buf to the receive queue, over the oldest
+// one. Written once, however many readers there are
+// Called from the PLL only
+static void vw_rx_queue_put(struct vw_channel *ch)
+{
+   struct vw_rx_ring *ring = ch->rx_ring;
+   unsigned int head = ring->head;
+   struct vw_rx_frame *frame = &ring->frame[head & (ring->len - 1)];
+
+   // A reader still copying the old message sees gen change and drops it
+   WRITE_ONCE(frame->gen, frame->gen + 1);
+   smp_wmb();
+
+   frame->seq = head;
+   frame->len = ch->rx_len;
+   vw_rx_meta(ch, &frame->meta);
+   memcpy(frame->buf, ch->rx_buf, ch->rx_len);
+
+   // The slot is complete again, then publish the new head
+   smp_store_release(&frame->gen, frame->gen + 1);
+   smp_store_release(&ring->head, head + 1);
+
+   if (ch->rx_callback)
+      ch->rx_callback(ch);
+}
+
+uint8_t vw_add_rx_rate(struct vw_channel *ch, struct vw_channel *rate)
+{
+   if (ch->rx_rates >= VW_RX_RATES_MAX)
+      return false;
+
+   vw_init(rate, ch->id);
+   rate->rx_parent = ch;
+   rate->rx_ring = ch->rx_ring;
+   rate->rx_callback = ch->rx_callback;
+   rate->priv = ch->priv;
+   rcu_assign_pointer(rate->rx_filter, rcu_dereference_protected(ch->rx_filter, true));
+   rate->rx_dedup_window = ch->rx_dedup_window;
+
+   ch->rx_rate[ch->rx_rates++] = rate;
+   return true;
+}
+
+void vw_set_rx_step(struct vw_channel *rate, unsigned int step)
+{
+   rate->rx_step = step;
+   rate->rx_step_count = 0;
+}
 
-   // Linear search :-( Could have a 64 byte reverse lookup table?
-   for (i = 0; i < 16; i++) {
-      if (symbol == symbols[i]) {
-         return i;
+// Hand the samples the PLL has just taken on to the decoders for other
+// rates, every rx_step'th to each. Called from the PLL only
+static void vw_rx_rates(struct vw_channel *ch, uint32_t samples, unsigned int count)
+{
+   struct vw_channel *rate;
+   unsigned int i, j, n;
+   uint32_t taken;
+
+   for (i = 0; i < ch->rx_rates; i++)
+   {
+      rate = ch->rx_rate[i];
+      if (!rate->rx_enabled || !rate->rx_step)
+         continue;
+
+      // The PLL of the channel is past these samples already
+      rate->rx_parent_clock = ch->rx_clock - count + rate->rx_step_count
+         - rate->rx_clock * rate->rx_step;
+
+      if (rate->rx_step == 1)
+      {
+         vw_pll_word(rate, samples, count);
+         continue;
       }
-   }
 
-   return 0; // Not found
+      taken = 0;
+      n = 0;
+      for (j = rate->rx_step_count; j < count; j += rate->rx_step)
+         taken |= ((samples >> j) & 1) << n++;
+      rate->rx_step_count = j - count;
+      vw_pll_word(rate, taken, n);
+   }
 }
 
-// Set the output pin number for transmitter data
-void vw_set_tx_pin(uint8_t pin)
+// Select edge driven reception. The receiver pin is then no longer sampled
+// by vw_int_handler(), the caller reconstructs the samples between edges
+// and hands them to vw_rx_feed()
+void vw_set_rx_edge_mode(struct vw_channel *ch, uint8_t enable)
 {
-   transmitter.gpio = pin;
+   ch->rx_edge_mode = enable;
 }
 
-// Set the pin number for input receiver data
-void vw_set_rx_pin(uint8_t pin)
+// Select deferred decoding. vw_int_handler() then only captures the
+// receiver samples and calls ready every batch words, the caller decodes
+// them with vw_rx_decode()
+void vw_set_rx_deferred(struct vw_channel *ch, unsigned int batch,
+                        void (*ready)(struct vw_channel *ch))
 {
-   receiver.gpio = pin;
+   ch->rx_deferred = (batch > 0);
+   ch->rx_capture_batch = Limit(batch, 1, VW_RX_CAPTURE_WORDS);
+   ch->rx_capture_callback = ready;
 }
 
-// Set the output pin number for transmitter PTT enable
-void vw_set_ptt_pin(uint8_t pin)
+// Pack one receiver sample into the capture word, called from
+// vw_int_handler() only. A full word goes to the capture ring, or is
+// counted as lost if vw_rx_decode() has not kept up
+static void vw_rx_capture(struct vw_channel *ch, uint8_t sample)
 {
-   ptt.gpio = pin;
+   unsigned int head, slot;
+
+   ch->rx_capture_word |= (uint32_t)sample << ch->rx_capture_bits;
+   if (++ch->rx_capture_bits < 32)
+      return;
+
+   head = ch->rx_capture_head;
+   if (head - smp_load_acquire(&ch->rx_capture_tail) >= VW_RX_CAPTURE_WORDS)
+   {
+      WRITE_ONCE(ch->rx_capture_lost, ch->rx_capture_lost + 1);
+      ch->rx_capture_skipped++;
+   }
+   else
+   {
+      slot = head & (VW_RX_CAPTURE_WORDS - 1);
+      ch->rx_capture[slot] = ch->rx_capture_word;
+      ch->rx_capture_skip[slot] = ch->rx_capture_skipped;
+      ch->rx_capture_skipped = 0;
+      // Publish the word before the new head
+      smp_store_release(&ch->rx_capture_head, head + 1);
+   }
+   ch->rx_capture_word = 0;
+   ch->rx_capture_bits = 0;
+   WRITE_ONCE(ch->rx_capture_clock, ch->rx_capture_clock + 32);
+
+   if (++ch->rx_capture_pending >= ch->rx_capture_batch)
+   {
+      ch->rx_capture_pending = 0;
+      if (ch->rx_capture_callback)
+         ch->rx_capture_callback(ch);
+   }
 }
 
-// Set the ptt pin inverted (low to transmit)
-void vw_set_ptt_inverted(uint8_t inverted)
+// Decode everything captured so far, the consumer side of the capture ring
+unsigned int vw_rx_decode(struct vw_channel *ch)
 {
-   vw_ptt_inverted = inverted;
+   unsigned int tail = ch->rx_capture_tail;
+   unsigned int head = smp_load_acquire(&ch->rx_capture_head);
+   unsigned int count = head - tail;
+   unsigned int slot;
+
+   while (tail != head)
+   {
+      slot = tail & (VW_RX_CAPTURE_WORDS - 1);
+      // The words dropped before this one were sampled all the same, keep
+      // the clock in step with the timestamps
+      ch->rx_clock += ch->rx_capture_skip[slot] * 32;
+      vw_pll_word(ch, ch->rx_capture[slot], 32);
+      // Hand the slot back as soon as it is read
+      smp_store_release(&ch->rx_capture_tail, ++tail);
+   }
+   return count;
 }
 
-// Set the LED status pin 
-void vw_set_led_pin(uint8_t pin)
+// One bit out of the PLL, LSB first
+// Collects the start symbol and then the message symbols
+static void vw_rx_bit(struct vw_channel *ch, uint8_t bit)
 {
-   led.gpio = pin;
+   // Add this to the 12th bit of ch->rx_bits, LSB first
+   // The last 12 bits are kept
+   ch->rx_bits >>= 1;
+   if (bit)
+      ch->rx_bits |= 0x800;
+
+   if (ch->rx_active)
+   {
+      // We have the start symbol and now we are collecting message bits,
+      // 6 per symbol, each which has to be decoded to 4 bits
+      if (++ch->rx_bit_count >= 12)
+      {
+         // Have 12 bits of encoded message == 1 byte encoded
+         // Decode both 6 bit symbols into a byte in one lookup
+         // The 6 lsbits are the high nybble
+         uint16_t decoded = vw_decode_symbols(ch->rx_bits);
+         uint8_t this_byte = decoded;
+         const struct vw_rx_filter *filter;
+         unsigned long window;
+
+         if (decoded & VW_CODEC_INVALID)
+         {
+            // Not a valid symbol, the rest of the message can not be
+            // trusted either, so drop it now
+            ch->rx_active = false;
+            vw_rx_count(ch, rx_symbol_err);
+            trace_vwire_rx_symbol_reject(ch->id, ch->rx_len, ch->rx_bits);
+
+            if (ch->led.gpio > 0)
+               gpio_set_value(ch->led.gpio, 0); 
+            return;
+         }
+
+         // The first decoded byte is the byte count of the following message
+         // the count includes the byte count and the 2 trailing FCS bytes
+         // REVISIT: may also include the ACK flag at 0x40
+         if (ch->rx_len == 0)
+         {
+            // The first byte is the byte count
+            // Check it for sensibility. It cant be less than 4, since it
+            // includes the bytes count itself and the 2 byte FCS
+            ch->rx_count = this_byte;
+            if (ch->rx_count < 4 || ch->rx_count > VW_MAX_MESSAGE_LEN)
+            {
+               // Stupid message length, drop the whole thing
+               ch->rx_active = false;
+               vw_rx_count(ch, rx_length_err);
+               trace_vwire_rx_length_reject(ch->id, this_byte);
+               vw_rx_tap_event(ch, VW_RX_TAP_LENGTH_REJECT);
+
+               if (ch->led.gpio > 0)
+                  gpio_set_value(ch->led.gpio, 0); 
+               return;
+            }
+         }
+
+         trace_vwire_rx_byte(ch->id, ch->rx_len, this_byte);
+         ch->rx_buf[ch->rx_len++] = this_byte;
+         ch->rx_crc = vw_crc_update(ch->rx_crc, this_byte);
+
+         if (ch->rx_len >= ch->rx_count)
+         {
+            // Got all the bytes now
+            ch->rx_active = false;
+            trace_vwire_rx_frame(ch->id, ch->rx_len);
+            trace_vwire_rx_crc(ch->id, ch->rx_crc, ch->rx_crc == 0xf0b8);
+            if (ch->rx_crc == 0xf0b8)
+               vw_rx_count(ch, rx_good);
+            else
+               vw_rx_count(ch, rx_crc_err);
+
+            // Someone else's traffic goes no further, nobody is woken
+            filter = rcu_dereference_sched(ch->rx_filter);
+            window = READ_ONCE(ch->rx_dedup_window);
+            if (filter && !vw_rx_filter_match(filter, ch->rx_buf + 1, ch->rx_len - 3))
+               vw_rx_count(ch, rx_filtered);
+            else if (window && ch->rx_crc == 0xf0b8 && vw_rx_duplicate(ch, window))
+               vw_rx_count(ch, rx_duplicate);
+            else
+               vw_rx_queue_put(ch);
+         }
+         ch->rx_bit_count = 0;
+      }
+   }
+   // Not in a message, see if we have a start symbol
+   else if (ch->rx_bits == 0xb38)
+   {
+      if (ch->led.gpio > 0)
+         gpio_set_value(ch->led.gpio, 1); 
+
+      // Have start symbol, start collecting message
+      trace_vwire_rx_start(ch->id);
+      vw_rx_tap_event(ch, VW_RX_TAP_START);
+      vw_rx_count(ch, rx_start);
+      ch->rx_active = true;
+      ch->rx_bit_count = 0;
+      ch->rx_len = 0;
+      ch->rx_crc = 0xffff;
+
+      // The start symbol began 12 bits ago, time and quality count from there
+      ch->rx_start_clock = ch->rx_clock - 12 * ch->samples_per_bit;
+      ch->rx_transitions = 0;
+      ch->rx_phase_err = 0;
+   }
 }
 
-void vw_set_verbose_debug(uint8_t val)
+// Account a transition seen at ramp position ramp, for the quality
+static inline void vw_rx_phase(struct vw_channel *ch, uint8_t ramp)
 {
-   vw_verbose_debug = val;
+   ch->rx_phase_err += (ramp < VW_RAMP_TRANSITION) ? ramp : VW_RX_RAMP_LEN - ramp;
+   ch->rx_transitions++;
 }
 
-// Called 8 times per bit period
+// Called samples_per_bit (8) times per bit period
 // Phase locked loop tries to synchronise with the transmitter so that bit 
-// transitions occur at about the time vw_rx_pll_ramp is 0;
+// transitions occur at about the time ch->rx_pll_ramp is 0;
 // Then the average is computed over each bit period to deduce the bit value
-void vw_pll()
+void vw_pll(struct vw_channel *ch)
 {
+   uint8_t bit;
+
+   if (vw_rx_tapped(ch))
+      ch->rx_tap(ch, ch->rx_sample, 1);
+
+   ch->rx_clock++;
+
    // Integrate each sample
-   if (vw_rx_sample)
-      vw_rx_integrator++;
+   if (ch->rx_sample)
+      ch->rx_integrator++;
 
-   if (vw_rx_sample != vw_rx_last_sample)
+   if (ch->rx_sample != ch->rx_last_sample)
    {
       // Transition, advance if ramp > 80, retard if < 80
-      vw_rx_pll_ramp += ((vw_rx_pll_ramp < VW_RAMP_TRANSITION) ? VW_RAMP_INC_RETARD : VW_RAMP_INC_ADVANCE);
-      vw_rx_last_sample = vw_rx_sample;
+      vw_rx_phase(ch, ch->rx_pll_ramp);
+      ch->rx_pll_ramp += ((ch->rx_pll_ramp < VW_RAMP_TRANSITION) ? ch->rx_ramp_inc_retard : ch->rx_ramp_inc_advance);
+      ch->rx_last_sample = ch->rx_sample;
    }
    else
    {
       // No transition
       // Advance ramp by standard 20 (== 160/8 samples)
-      vw_rx_pll_ramp += VW_RAMP_INC;
+      ch->rx_pll_ramp += ch->rx_ramp_inc;
    }
 
-   if (vw_rx_pll_ramp >= VW_RX_RAMP_LEN)
+   if (ch->rx_pll_ramp >= VW_RX_RAMP_LEN)
    {
-      // Add this to the 12th bit of vw_rx_bits, LSB first
-      // The last 12 bits are kept
-      vw_rx_bits >>= 1;
-
       // Check the integrator to see how many samples in this cycle were high.
       // If < 5 out of 8, then its declared a 0 bit, else a 1;
-      if (vw_rx_integrator >= 5)
-         vw_rx_bits |= 0x800;
-
-      vw_rx_pll_ramp -= VW_RX_RAMP_LEN;
-      vw_rx_integrator = 0; // Clear the integral for the next cycle
-
-      if (vw_rx_active)
-      {
-         // We have the start symbol and now we are collecting message bits,
-         // 6 per symbol, each which has to be decoded to 4 bits
-         if (++vw_rx_bit_count >= 12)
-         {
-            // Have 12 bits of encoded message == 1 byte encoded
-            // Decode as 2 lots of 6 bits into 2 lots of 4 bits
-            // The 6 lsbits are the high nybble
-            uint8_t this_byte = 
-               (vw_symbol_6to4(vw_rx_bits & 0x3f)) << 4 
-               | vw_symbol_6to4(vw_rx_bits >> 6);
-
-            // The first decoded byte is the byte count of the following message
-            // the count includes the byte count and the 2 trailing FCS bytes
-            // REVISIT: may also include the ACK flag at 0x40
-            if (vw_rx_len == 0)
-            {
-               // The first byte is the byte count
-               // Check it for sensibility. It cant be less than 4, since it
-               // includes the bytes count itself and the 2 byte FCS
-               vw_rx_count = this_byte;
-               if (vw_rx_count < 4 || vw_rx_count > VW_MAX_MESSAGE_LEN)
-               {
-                  // Stupid message length, drop the whole thing
-                  vw_rx_active = false;
-                  vw_rx_bad++;
-
-                  if (vw_verbose_debug)
-                     printk(KERN_DEBUG VWIRE_DRV_NAME ": Dropping message...\n");
-                  gpio_set_value(led.gpio, 0); 
-                  return;
-               }
-            }
+      bit = (ch->rx_integrator >= ch->rx_integrator_threshold);
 
-            vw_rx_buf[vw_rx_len++] = this_byte;
+      ch->rx_pll_ramp -= VW_RX_RAMP_LEN;
+      ch->rx_integrator = 0; // Clear the integral for the next cycle
 
-            if (vw_verbose_debug)
-               printk(KERN_DEBUG VWIRE_DRV_NAME ": this_byte: %02x\n", this_byte);
+      vw_rx_bit(ch, bit);
+   }
 
-            if (vw_rx_len >= vw_rx_count)
-            {
-               // Got all the bytes now
-               vw_rx_active = false;
-               vw_rx_good++;
-               vw_rx_done = true; // Better come get it before the next one starts
+   if (ch->rx_rates)
+      vw_rx_rates(ch, ch->rx_sample, 1);
+}
 
-               if (vw_verbose_debug)
-                  printk(KERN_DEBUG VWIRE_DRV_NAME ": Rx all bytes. vw_rx_good: %d\n", vw_rx_good);
-            }
-            vw_rx_bit_count = 0;
-         }
-      }
-      // Not in a message, see if we have a start symbol
-      else if (vw_rx_bits == 0xb38)
+// The same PLL over up to 32 samples at once, oldest in bit 0.
+// Between two transitions the ramp only advances by rx_ramp_inc, so the
+// samples up to the next transition or the end of the bit are integrated
+// with one popcount and the ramp moved in one step. Only a transition
+// costs a step of its own, which makes an idle or clean signal cheap.
+// The bits out are the same as from count calls of vw_pll()
+void vw_pll_word(struct vw_channel *ch, uint32_t samples, unsigned int count)
+{
+   uint32_t trans, in;
+   unsigned int run, left, total;
+   uint8_t last, bit;
+
+   if (count == 0)
+      return;
+   if (count > 32)
+      count = 32;
+   if (vw_rx_tapped(ch))
+      ch->rx_tap(ch, samples, count);
+   in = samples;
+   total = count;
+   last = (samples >> (count - 1)) & 1;
+
+   // Bit n is set if sample n differs from the one before it
+   trans = samples ^ ((samples << 1) | ch->rx_last_sample);
+
+   while (count > 0)
+   {
+      // Samples left in this bit if none of them is a transition, at
+      // most VW_RX_RAMP_LEN / rx_ramp_inc (16)
+      left = ((VW_RX_RAMP_LEN - ch->rx_pll_ramp + ch->rx_ramp_inc - 1) * ch->rx_ramp_recip) >> 16;
+      if (left > count)
+         left = count;
+
+      run = (trans & ((1u << left) - 1)) ? __ffs(trans) : left;
+
+      // No transition in the first run samples
+      ch->rx_integrator += hweight32(samples & ((1u << run) - 1));
+      ch->rx_pll_ramp += run * ch->rx_ramp_inc;
+      ch->rx_clock += run;
+      samples >>= run;
+      trans >>= run;
+      count -= run;
+
+      if (run < left)
       {
-         gpio_set_value(led.gpio, 1); 
-
-         if (vw_verbose_debug)
-            printk(KERN_DEBUG VWIRE_DRV_NAME ": We have a start symbol...\n");
+         // Transition, advance if ramp > 80, retard if < 80
+         ch->rx_integrator += samples & 1;
+         ch->rx_clock++;
+         vw_rx_phase(ch, ch->rx_pll_ramp);
+         ch->rx_pll_ramp += ((ch->rx_pll_ramp < VW_RAMP_TRANSITION) ? ch->rx_ramp_inc_retard : ch->rx_ramp_inc_advance);
+         samples >>= 1;
+         trans >>= 1;
+         count--;
+      }
 
-         // Have start symbol, start collecting message
-         vw_rx_active = true;
-         vw_rx_bit_count = 0;
-         vw_rx_len = 0;
-         vw_rx_done = false; // Too bad if you missed the last message
+      if (ch->rx_pll_ramp >= VW_RX_RAMP_LEN)
+      {
+         bit = (ch->rx_integrator >= ch->rx_integrator_threshold);
+         ch->rx_pll_ramp -= VW_RX_RAMP_LEN;
+         ch->rx_integrator = 0;
+         vw_rx_bit(ch, bit);
       }
    }
+
+   ch->rx_sample = last;
+   ch->rx_last_sample = last;
+
+   // After this PLL, so the other rates are timed from its rx_clock
+   if (ch->rx_rates)
+      vw_rx_rates(ch, in, total);
 }
 
 
-// Start the transmitter, call when the tx buffer is ready to go and vw_tx_len is
-// set to the total number of symbols to send
-void vw_tx_start()
+// Point the transmitter at the message at the head of the queue
+static void vw_tx_load(struct vw_channel *ch)
+{
+   const struct vw_tx_frame *frame = &ch->tx_queue[ch->tx_queue_tail & (ch->tx_queue_len - 1)];
+
+   ch->tx_buf = frame->buf;
+   ch->tx_len = frame->len;
+   ch->tx_index = 0;
+   ch->tx_bit = 0;
+   trace_vwire_tx_start(ch->id, ch->tx_len);
+}
+
+// Start the transmitter, call when there is a message in the queue
+// Called from the interrupt handler when it finds the transmitter idle
+void vw_tx_start(struct vw_channel *ch)
 {
-   vw_tx_index = 0;
-   vw_tx_bit = 0;
-   vw_tx_sample = 0;
+   vw_tx_load(ch);
+   ch->tx_sample = 0;
 
    // Enable the transmitter hardware
-   if (ptt.gpio > 0)
-      gpio_set_value(ptt.gpio, true ^ vw_ptt_inverted);
+   if (ch->ptt.gpio > 0)
+   {
+      gpio_set_value(ch->ptt.gpio, true ^ ch->ptt_inverted);
+      trace_vwire_ptt(ch->id, true);
+   }
 
    // Next tick interrupt will send the first bit
-   vw_tx_enabled = true;
+   ch->tx_enabled = true;
 }
 
 // Stop the transmitter, call when all bits are sent
-void vw_tx_stop()
+void vw_tx_stop(struct vw_channel *ch)
 {
    // Disable the transmitter hardware
-   if (ptt.gpio > 0)
-      gpio_set_value(ptt.gpio, false ^ vw_ptt_inverted);
-   gpio_set_value(transmitter.gpio, false);
+   if (ch->ptt.gpio > 0)
+   {
+      gpio_set_value(ch->ptt.gpio, false ^ ch->ptt_inverted);
+      trace_vwire_ptt(ch->id, false);
+   }
+   if (ch->transmitter.label)
+      gpio_set_value(ch->transmitter.gpio, false);
 
    // No more ticks for the transmitter
-   vw_tx_enabled = false;
+   ch->tx_enabled = false;
+   trace_vwire_tx_stop(ch->id);
+}
+
+// Stop sending the message on the air, if any. It stays in the transmit
+// queue and is sent again from its start by the next vw_int_handler()
+// Only call it while vw_int_handler() can not run
+void vw_tx_rewind(struct vw_channel *ch)
+{
+   if (ch->tx_enabled)
+      vw_tx_stop(ch);
 }
 
-// Enable the receiver. When a message becomes available, vw_rx_done flag
-// is set, and vw_wait_rx() will return.
-void vw_rx_start()
+// Enable the receiver. When a message becomes available, it is queued
+// and vw_wait_rx() will return.
+void vw_rx_start(struct vw_channel *ch)
 {
-   if (!vw_rx_enabled)
+   unsigned int i;
+
+   if (!ch->rx_enabled)
    {
-      vw_rx_enabled = true;
-      vw_rx_active = false; // Never restart a partial message
+      ch->rx_enabled = true;
+      ch->rx_active = false; // Never restart a partial message
+
+      // Nor decode samples from before the stop
+      ch->rx_capture_word = 0;
+      ch->rx_capture_bits = 0;
+      ch->rx_capture_pending = 0;
+      ch->rx_capture_skipped = 0;
+      ch->rx_capture_tail = ch->rx_capture_head;
+
+      // The sample clock counts as vw_rx_capture() does, see
+      // vw_rx_sample_time()
+      ch->rx_clock = ch->rx_capture_clock;
+      ch->rx_step_count = 0;
    }
+
+   for (i = 0; i < ch->rx_rates; i++)
+      vw_rx_start(ch->rx_rate[i]);
 }
 
 // Disable the receiver
-void vw_rx_stop()
+void vw_rx_stop(struct vw_channel *ch)
 {
-   vw_rx_enabled = false;
+   unsigned int i;
+
+   ch->rx_enabled = false;
+   for (i = 0; i < ch->rx_rates; i++)
+      vw_rx_stop(ch->rx_rate[i]);
+}
+
+// Feed count identical samples into the PLL, as if vw_int_handler() had
+// read sample from the receiver pin count times in a row
+// Used in edge mode, where the pin only changes at the reported edges
+void vw_rx_feed(struct vw_channel *ch, uint8_t sample, unsigned int count)
+{
+   if (!ch->rx_enabled || ch->tx_enabled)
+      return;
+
+   while (count >= 32)
+   {
+      vw_pll_word(ch, sample ? 0xffffffff : 0, 32);
+      count -= 32;
+   }
+   vw_pll_word(ch, sample ? 0xffffffff : 0, count);
+}
+
+// Return true while a message is being decoded, ie the start symbol was
+// seen but not all of the bytes have arrived yet
+uint8_t vw_rx_in_progress(struct vw_channel *ch)
+{
+   unsigned int i;
+
+   for (i = 0; i < ch->rx_rates; i++)
+      if (ch->rx_rate[i]->rx_active)
+         return true;
+   return ch->rx_active;
 }
 
 // Return true if the transmitter is active
-uint8_t vx_tx_active()
+uint8_t vx_tx_active(struct vw_channel *ch)
 {
-   return vw_tx_enabled;
+   return ch->tx_enabled;
 }
 
 // Wait for the transmitter to become available
-// Busy-wait loop until the ISR says the message has been sent
-void vw_wait_tx()
+// Busy-wait loop until the ISR says all queued messages have been sent
+void vw_wait_tx(struct vw_channel *ch)
 {
-   while (vw_tx_enabled) 
+   while (vw_tx_queue_count(ch)) 
    {
       ;
    }
@@ -350,9 +884,9 @@ void vw_wait_tx()
 // Wait for the receiver to get a message
 // Busy-wait loop until the ISR says a message is available
 // can then call vw_get_message()
-void vw_wait_rx()
+void vw_wait_rx(struct vw_channel *ch)
 {
-   while (!vw_rx_done) 
+   while (!vw_have_message(ch)) 
    {
       ;
    }
@@ -361,189 +895,287 @@ void vw_wait_rx()
 // Wait at most max milliseconds for the receiver to receive a message
 // Return the truth of whether there is a message
 // TODO: Test this --wjs
-uint8_t vw_wait_rx_max(unsigned long milliseconds)
+uint8_t vw_wait_rx_max(struct vw_channel *ch, unsigned long milliseconds)
 {
    unsigned long start = jiffies;
 
-   while (!vw_rx_done && ((jiffies - start) < milliseconds)) {
+   while (!vw_have_message(ch) && ((jiffies - start) < milliseconds)) {
       ;
    }
 
-   return vw_rx_done;
+   return vw_have_message(ch);
 }
 
-// Wait until transmitter is available and encode and queue the message
-// into vw_tx_buf
+// Encode the message and add it to the transmit queue
 // The message is raw bytes, with no packet structure imposed
 // It is transmitted preceded a byte count and followed by 2 FCS bytes
-uint8_t vw_send(const uint8_t* buf, uint8_t len)
+// Returns at once, the interrupt handler sends queued messages back to back
+// Only one caller at a time, the caller has to serialize writers
+uint8_t vw_send(struct vw_channel *ch, const uint8_t* buf, uint8_t len)
 {
    uint8_t i;
    uint8_t index = 0;
    uint16_t crc = 0xffff;
-   uint8_t *p = vw_tx_buf + VW_HEADER_LEN; // start of the message area
+   unsigned int head = ch->tx_queue_head;
+   struct vw_tx_frame *frame;
+   uint8_t *p;
    uint8_t count = len + 3; // Added byte count and FCS to get total number of bytes
 
    if (len > VW_MAX_PAYLOAD)
       return false;
 
-   // Wait for transmitter to become available
-   vw_wait_tx();
+   // Room in the queue? The tail slot is only released once it is sent
+   if (head - smp_load_acquire(&ch->tx_queue_tail) >= ch->tx_queue_len)
+   {
+      WRITE_ONCE(ch->tx_full, ch->tx_full + 1);
+      return false;
+   }
+
+   frame = &ch->tx_queue[head & (ch->tx_queue_len - 1)];
+   memcpy(frame->buf, vw_tx_header, VW_HEADER_LEN);
+   p = frame->buf + VW_HEADER_LEN; // start of the message area
 
    // Encode the message length
-   crc = _crc_ccitt_update(crc, count);
-   p[index++] = symbols[count >> 4];
-   p[index++] = symbols[count & 0xf];
+   crc = vw_crc_update(crc, count);
+   p[index++] = vw_symbols[count >> 4];
+   p[index++] = vw_symbols[count & 0xf];
 
    // Encode the message into 6 bit symbols. Each byte is converted into 
    // 2 6-bit symbols, high nybble first, low nybble second
    for (i = 0; i < len; i++)
    {
-      crc = _crc_ccitt_update(crc, buf[i]);
-      p[index++] = symbols[buf[i] >> 4];
-      p[index++] = symbols[buf[i] & 0xf];
+      crc = vw_crc_update(crc, buf[i]);
+      p[index++] = vw_symbols[buf[i] >> 4];
+      p[index++] = vw_symbols[buf[i] & 0xf];
    }
 
    // Append the fcs, 16 bits before encoding (4 6-bit symbols after encoding)
    // Caution: VW expects the _ones_complement_ of the CCITT CRC-16 as the FCS
    // VW sends FCS as low byte then hi byte
    crc = ~crc;
-   p[index++] = symbols[(crc >> 4)  & 0xf];
-   p[index++] = symbols[crc & 0xf];
-   p[index++] = symbols[(crc >> 12) & 0xf];
-   p[index++] = symbols[(crc >> 8)  & 0xf];
+   p[index++] = vw_symbols[(crc >> 4)  & 0xf];
+   p[index++] = vw_symbols[crc & 0xf];
+   p[index++] = vw_symbols[(crc >> 12) & 0xf];
+   p[index++] = vw_symbols[(crc >> 8)  & 0xf];
 
    // Total number of 6-bit symbols to send
-   vw_tx_len = index + VW_HEADER_LEN;
+   frame->len = index + VW_HEADER_LEN;
 
-   // Start the low level interrupt handler sending symbols
-   vw_tx_start();
+   // Publish the symbols before the new head, the interrupt handler
+   // starts sending when it sees it
+   smp_store_release(&ch->tx_queue_head, head + 1);
 
    return true;
 }
 
 // Return true if there is a message available
-uint8_t vw_have_message()
+uint8_t vw_have_message(struct vw_channel *ch)
 {
-   return vw_rx_done;
+   return vw_rx_cursor_have(ch, &ch->rx_reader);
 }
 
-// Get the last message received (without byte count or FCS)
-// Copy at most *len bytes, set *len to the actual number copied
-// Return true if there is a message and the FCS is OK
-uint8_t vw_get_message(uint8_t* buf, uint8_t* len)
+// Only messages that arrive from now on
+void vw_rx_cursor_init(struct vw_channel *ch, struct vw_rx_cursor *cur)
 {
+   cur->seq = smp_load_acquire(&ch->rx_ring->head);
+   cur->dropped = 0;
+}
+
+uint8_t vw_rx_cursor_have(struct vw_channel *ch, const struct vw_rx_cursor *cur)
+{
+   return READ_ONCE(ch->rx_ring->head) != cur->seq;
+}
+
+// Copy the next message for this reader. Nothing is written to the queue,
+// so readers never wait for each other or for the PLL. The copy is only
+// good if the slot had an even gen that did not change while copying and
+// still holds the message wanted, else the PLL has lapped this reader
+uint8_t vw_rx_cursor_get(struct vw_channel *ch, struct vw_rx_cursor *cur,
+                         uint8_t* buf, uint8_t* len, struct vw_rx_meta *meta)
+{
+   const struct vw_rx_ring *ring = ch->rx_ring;
+   const struct vw_rx_frame *frame;
+   struct vw_rx_meta frame_meta;
+   unsigned int head, gen;
    uint8_t rxlen;
 
-   // Message available?
-   if (!vw_rx_done)
-      return false;
+   for (;;)
+   {
+      // Read the head before the frames it publishes
+      head = smp_load_acquire(&ring->head);
+      if (head == cur->seq)
+      {
+         *len = 0;
+         return false;
+      }
 
-   // Wait until vw_rx_done is set before reading vw_rx_len
-   // then remove bytecount and FCS
-   rxlen = vw_rx_len - 3;
+      // Fallen behind by more than the queue, skip to the oldest frame
+      if (head - cur->seq > ring->len)
+      {
+         cur->dropped += head - cur->seq - ring->len;
+         cur->seq = head - ring->len;
+      }
 
-   // Copy message (good or bad)
-   if (*len > rxlen)
-      *len = rxlen;
+      frame = &ring->frame[cur->seq & (ring->len - 1)];
+      gen = smp_load_acquire(&frame->gen);
+      if (!(gen & 1) && READ_ONCE(frame->seq) == cur->seq)
+      {
+         // Remove bytecount and FCS
+         rxlen = READ_ONCE(frame->len);
+         rxlen = Limit(rxlen, 3, VW_MAX_MESSAGE_LEN) - 3;
 
-   memcpy(buf, vw_rx_buf + 1, *len);
+         // Copy message (good or bad)
+         if (rxlen > *len)
+            rxlen = *len;
+         memcpy(buf, frame->buf + 1, rxlen);
 
-   vw_rx_done = false; // OK, got that message thanks
+         // The FCS was checked as the bytes came in
+         frame_meta = frame->meta;
 
-   // Check the FCS, return goodness
-   return (vw_crc(vw_rx_buf, vw_rx_len) == 0xf0b8); // FCS OK?
+         smp_rmb();
+         if (READ_ONCE(frame->gen) == gen)
+         {
+            cur->seq++;
+            *len = rxlen;
+            if (meta)
+               *meta = frame_meta;
+            return frame_meta.crc_ok;
+         }
+      }
+
+      // Overwritten while we looked, that one is gone
+      cur->seq++;
+      cur->dropped++;
+   }
+}
+
+// Get the oldest message received (without byte count or FCS)
+// Copy at most *len bytes, set *len to the actual number copied
+// Return true if there is a message and the FCS is OK
+// Only one caller at a time, the caller has to serialize readers
+uint8_t vw_get_message(struct vw_channel *ch, uint8_t* buf, uint8_t* len)
+{
+   return vw_rx_cursor_get(ch, &ch->rx_reader, buf, len, NULL);
 }
 
 // This is the interrupt service routine called when timer1 overflows
-// Its job is to output the next bit from the transmitter (every 8 calls)
+// Its job is to output the next bit from the transmitter (every samples_per_bit calls)
 // and to call the PLL code if the receiver is enabled
-void vw_int_handler(void)
+void vw_int_handler(struct vw_channel *ch)
 {
-   if (vw_rx_enabled && !vw_tx_enabled) 
+   // Anything new to send?
+   if (!ch->tx_enabled && smp_load_acquire(&ch->tx_queue_head) != ch->tx_queue_tail)
+   {
+      vw_tx_start(ch);
+   }
+
+   if (ch->rx_enabled && !ch->tx_enabled && !ch->rx_edge_mode) 
    {
-      vw_rx_sample = gpio_get_value(receiver.gpio);
+      // In deferred mode the sample goes straight to the capture ring,
+      // rx_sample belongs to vw_rx_decode() then
+      if (ch->rx_deferred)
+         vw_rx_capture(ch, gpio_get_value(ch->receiver.gpio));
+      else
+         ch->rx_sample = gpio_get_value(ch->receiver.gpio);
    }
 
    // Do transmitter stuff first to reduce transmitter bit jitter due 
    // to variable receiver processing
-   if (vw_tx_enabled && vw_tx_sample++ == 0)
+   if (ch->tx_enabled && ch->tx_sample++ == 0)
    {
       // Send next bit
       // Symbols are sent LSB first
       // Finished sending the whole message? (after waiting one bit period 
       // since the last bit)
-      if (vw_tx_index >= vw_tx_len)
+      if (ch->tx_index >= ch->tx_len)
       {
-         vw_tx_stop();
-         vw_tx_msg_count++;
+         // Release the slot, then carry on with the next message if there
+         // is one without dropping PTT
+         smp_store_release(&ch->tx_queue_tail, ch->tx_queue_tail + 1);
+         u64_stats_update_begin(&ch->tx_syncp);
+         ch->stats.tx_frames++;
+         // every symbol and the bit period waited after the last one
+         ch->stats.tx_airtime_ns += ((uint64_t)ch->tx_len * 6 + 1) * ch->tx_bit_ns;
+         u64_stats_update_end(&ch->tx_syncp);
+
+         if (smp_load_acquire(&ch->tx_queue_head) != ch->tx_queue_tail)
+            vw_tx_load(ch);
+         else
+            vw_tx_stop(ch);
+
+         if (ch->tx_callback)
+            ch->tx_callback(ch);
       }
       else
       {
-         gpio_set_value(transmitter.gpio, vw_tx_buf[vw_tx_index] & (1 << vw_tx_bit++));
-         if (vw_tx_bit >= 6)
+         gpio_set_value(ch->transmitter.gpio, ch->tx_buf[ch->tx_index] & (1 << ch->tx_bit++));
+         if (ch->tx_bit >= 6)
          {
-            vw_tx_bit = 0;
-            vw_tx_index++;
+            ch->tx_bit = 0;
+            ch->tx_index++;
          }
       }
    }
 
-   if (vw_tx_sample > 7) 
+   if (ch->tx_sample >= ch->samples_per_bit) 
    {
-      vw_tx_sample = 0;
+      ch->tx_sample = 0;
    }
 
-   if (vw_rx_enabled && !vw_tx_enabled)
+   if (ch->rx_enabled && !ch->tx_enabled && !ch->rx_edge_mode && !ch->rx_deferred)
    {
-      vw_pll();
+      vw_pll(ch);
    }
 }
 
-int vw_setup(void)
+int vw_setup(struct vw_channel *ch)
 {
    int err = 0;
 
-   vw_cleanup();  /* free all gpios */
+   vw_cleanup(ch);  /* free all gpios */
 
    // register LED gpio
-   if (led.gpio > 0)
+   if (ch->led.gpio > 0)
    {
-      led.flags = GPIOF_OUT_INIT_LOW;
-      led.label = "LED 1";
-      err = gpio_request_one(led.gpio, led.flags, led.label);
+      ch->led.flags = GPIOF_OUT_INIT_LOW;
+      snprintf(ch->led_label, sizeof(ch->led_label), "LED %d", ch->id);
+      err = gpio_request_one(ch->led.gpio, ch->led.flags, ch->led_label);
       if (err) goto fail_led;
-      printk(KERN_INFO VWIRE_DRV_NAME ": Requested GPIO %d for %s\n", led.gpio, led.label);
+      ch->led.label = ch->led_label;
+      printk(KERN_INFO VWIRE_DRV_NAME ": Requested GPIO %d for %s\n", ch->led.gpio, ch->led.label);
    }
 
    // register receiver gpio
-   if (receiver.gpio > 0)
+   if (ch->receiver.gpio > 0)
    {
-      receiver.flags = GPIOF_IN;
-      receiver.label = "RX 1";
-      err = gpio_request_one(receiver.gpio, receiver.flags, receiver.label);
+      ch->receiver.flags = GPIOF_IN;
+      snprintf(ch->rx_label, sizeof(ch->rx_label), "RX %d", ch->id);
+      err = gpio_request_one(ch->receiver.gpio, ch->receiver.flags, ch->rx_label);
       if (err) goto fail_receiver;
-      printk(KERN_INFO VWIRE_DRV_NAME ": Requested GPIO %d for %s\n", receiver.gpio, receiver.label);
+      ch->receiver.label = ch->rx_label;
+      printk(KERN_INFO VWIRE_DRV_NAME ": Requested GPIO %d for %s\n", ch->receiver.gpio, ch->receiver.label);
    }
 
    // register transmitter gpio
-   if (transmitter.gpio > 0)
+   if (ch->transmitter.gpio > 0)
    {
-      transmitter.flags = GPIOF_OUT_INIT_LOW;
-      transmitter.label = "TX 1";
-      err = gpio_request_one(transmitter.gpio, transmitter.flags, transmitter.label);
+      ch->transmitter.flags = GPIOF_OUT_INIT_LOW;
+      snprintf(ch->tx_label, sizeof(ch->tx_label), "TX %d", ch->id);
+      err = gpio_request_one(ch->transmitter.gpio, ch->transmitter.flags, ch->tx_label);
       if (err) goto fail_transmitter;
-      printk(KERN_INFO VWIRE_DRV_NAME ": Requested GPIO %d for %s\n", transmitter.gpio, transmitter.label);
+      ch->transmitter.label = ch->tx_label;
+      printk(KERN_INFO VWIRE_DRV_NAME ": Requested GPIO %d for %s\n", ch->transmitter.gpio, ch->transmitter.label);
    }
 
    // register ptt gpio
-   if (ptt.gpio > 0)
+   if (ch->ptt.gpio > 0)
    {
-      ptt.flags = (vw_ptt_inverted ? GPIOF_OUT_INIT_LOW : GPIOF_OUT_INIT_HIGH);
-      ptt.label = "PTT 1";
-      err = gpio_request_one(ptt.gpio, ptt.flags, ptt.label);
+      ch->ptt.flags = (ch->ptt_inverted ? GPIOF_OUT_INIT_LOW : GPIOF_OUT_INIT_HIGH);
+      snprintf(ch->ptt_label, sizeof(ch->ptt_label), "PTT %d", ch->id);
+      err = gpio_request_one(ch->ptt.gpio, ch->ptt.flags, ch->ptt_label);
       if (err) goto fail_ptt;
-      printk(KERN_INFO VWIRE_DRV_NAME ": Requested GPIO %d for %s\n", ptt.gpio, ptt.label);
+      ch->ptt.label = ch->ptt_label;
+      printk(KERN_INFO VWIRE_DRV_NAME ": Requested GPIO %d for %s\n", ch->ptt.gpio, ch->ptt.label);
    }
 
    return 0;  /* success */
@@ -552,33 +1184,41 @@ int vw_setup(void)
    /* back everything out if failure */
    fail_ptt:
       printk(KERN_ERR VWIRE_DRV_NAME ": Unable to request GPIOs for ptts: %d\n", err);
-      gpio_free(ptt.gpio);
    fail_transmitter:
       printk(KERN_ERR VWIRE_DRV_NAME ": Unable to request GPIOs for transmitters: %d\n", err);
-      gpio_free(transmitter.gpio);
    fail_receiver:
       printk(KERN_ERR VWIRE_DRV_NAME ": Unable to request GPIOs for receivers: %d\n", err);
-      gpio_free(receiver.gpio);
    fail_led:
       printk(KERN_ERR VWIRE_DRV_NAME ": Unable to request GPIOs for LED: %d\n", err);
-      gpio_free(led.gpio);
+      vw_cleanup(ch);
    return err;
 
 }
 
-void vw_cleanup(void)
+// Free the pins vw_setup() got. A pin's label is only set once it is ours
+void vw_cleanup(struct vw_channel *ch)
 {
-   gpio_free(ptt.gpio);
-   gpio_free(transmitter.gpio);
-   gpio_free(receiver.gpio);
-   gpio_free(led.gpio);
+   if (ch->ptt.label)
+      gpio_free(ch->ptt.gpio);
+   if (ch->transmitter.label)
+      gpio_free(ch->transmitter.gpio);
+   if (ch->receiver.label)
+      gpio_free(ch->receiver.gpio);
+   if (ch->led.label)
+      gpio_free(ch->led.gpio);
+
+   ch->ptt.label = NULL;
+   ch->transmitter.label = NULL;
+   ch->receiver.label = NULL;
+   ch->led.label = NULL;
 }
 
-void vw_shutdown(void)
+void vw_shutdown(struct vw_channel *ch)
 {
 
-   gpio_set_value(led.gpio, 0);  /* led off */
-   vw_cleanup();
+   if (ch->led.label)
+      gpio_set_value(ch->led.gpio, 0);  /* led off */
+   vw_cleanup(ch);
 }
 
 
@@ -143,29 +143,47 @@
 #define VW_MAX_MESSAGE_LEN 30
 
 /// The maximum payload length
-#define VW_MAX_PAYLOAD VW_MAX_MESSAGE_LEN-3
+#define VW_MAX_PAYLOAD (VW_MAX_MESSAGE_LEN-3)
 
 /// The size of the receiver ramp. Ramp wraps modulu this number
 #define VW_RX_RAMP_LEN 160
 
-/// Number of samples per bit
+/// Most received messages that can wait to be read
+#define VW_RX_QUEUE_MAX 64
+
+/// Most encoded messages that can wait to be sent
+#define VW_TX_QUEUE_MAX 16
+
+/// Words of 32 receiver samples that can wait for vw_rx_decode()
+#define VW_RX_CAPTURE_WORDS 64
+
+/// Number of samples per bit, unless changed with vw_set_samples_per_bit()
 #define VW_RX_SAMPLES_PER_BIT 8
 
+/// Fewest and most samples per bit, the ratio has to be a power of 2
+#define VW_RX_SAMPLES_PER_BIT_MIN 4
+#define VW_RX_SAMPLES_PER_BIT_MAX 16
+
+/// Most decoders for other baud rates on one channel, see vw_add_rx_rate()
+#define VW_RX_RATES_MAX 3
+
 // Ramp adjustment parameters
 // Standard is if a transition occurs before VW_RAMP_TRANSITION (80) in the ramp,
 // the ramp is retarded by adding VW_RAMP_INC_RETARD (11)
 // else by adding VW_RAMP_INC_ADVANCE (29)
 // If there is no transition it is adjusted by VW_RAMP_INC (20)
+// These are the values for 8 samples per bit, other ratios scale the
+// increment and keep the adjustment at the same 9/20 of it
 /// Internal ramp adjustment parameter
-#define VW_RAMP_INC (VW_RX_RAMP_LEN/VW_RX_SAMPLES_PER_BIT)
+#define VW_RAMP_INC(spb) (VW_RX_RAMP_LEN/(spb))
 /// Internal ramp adjustment parameter
 #define VW_RAMP_TRANSITION VW_RX_RAMP_LEN/2
+/// Internal ramp adjustment parameter, 9 at 8 samples per bit
+#define VW_RAMP_ADJUST(spb) ((VW_RAMP_INC(spb) * 9 + 10) / 20)
 /// Internal ramp adjustment parameter
-#define VW_RAMP_ADJUST 9
-/// Internal ramp adjustment parameter
-#define VW_RAMP_INC_RETARD (VW_RAMP_INC-VW_RAMP_ADJUST)
+#define VW_RAMP_INC_RETARD(spb) (VW_RAMP_INC(spb)-VW_RAMP_ADJUST(spb))
 /// Internal ramp adjustment parameter
-#define VW_RAMP_INC_ADVANCE (VW_RAMP_INC+VW_RAMP_ADJUST)
+#define VW_RAMP_INC_ADVANCE(spb) (VW_RAMP_INC(spb)+VW_RAMP_ADJUST(spb))
 
 /// Outgoing message bits grouped as 6-bit words
 /// 36 alternating 1/0 bits, followed by 12 bits of start symbol
@@ -176,97 +194,634 @@
 /// but each byte is transmitted high nybble first
 #define VW_HEADER_LEN 8
 
+/// What the receiver knows about a message besides its bytes
+struct vw_rx_meta
+{
+   /// When its start symbol began, from the function given to
+   /// vw_set_rx_timestamp(), or 0 without one
+   uint64_t time_ns;
+
+   /// True if the FCS was good
+   uint8_t crc_ok;
+
+   /// How close the transitions from the start symbol on were to where
+   /// the PLL expected them: 255 exactly on time, 0 half a bit off on
+   /// average, as on noise
+   uint8_t quality;
+
+   /// Baud rate it was decoded at, from vw_set_tx_bit_time() of the
+   /// channel or of the decoder for another rate, 0 if that was not set
+   uint16_t baud;
+
+   /// Makes the size 16 whatever the alignment of uint64_t, so a frame
+   /// looks the same to 32 and 64 bit readers of a mapped ring
+   uint8_t reserved[4];
+};
+
+/// A complete received message, byte count and FCS included
+/// gen is odd while the PLL rewrites the slot, seq is the number of the
+/// message in it, counting from vw_set_rx_queue_len()
+struct vw_rx_frame
+{
+   unsigned int gen;
+   unsigned int seq;
+   struct vw_rx_meta meta;
+   uint8_t len;
+   uint8_t buf[VW_MAX_MESSAGE_LEN];
+};
+
+/// Ring of the last len completed messages, shared by any number of
+/// readers. The PLL is the only writer, it never waits for a reader and
+/// overwrites the oldest message. Each reader keeps its own vw_rx_cursor
+/// and finds out from the slot's gen and seq whether what it copied is
+/// still the message it wanted. head runs freely and is masked with
+/// len-1 to index the ring. Nothing in it points anywhere, so it can be
+/// shared with readers in other address spaces, see vw_set_rx_ring()
+struct vw_rx_ring
+{
+   /// Number of the next message to be written
+   unsigned int head;
+
+   /// Slots in use, a power of 2
+   unsigned int len;
+
+   struct vw_rx_frame frame[VW_RX_QUEUE_MAX];
+};
+
+/// Where one reader is in the receive queue, see vw_rx_cursor_get()
+struct vw_rx_cursor
+{
+   /// Number of the next message to read
+   unsigned int seq;
+
+   /// Messages overwritten before this reader got to them
+   uint32_t dropped;
+};
+
+/// Most rules in a receive filter
+#define VW_RX_FILTER_MAX 16
+
+/// One rule of a receive filter. A message matches it if its payload is
+/// min_len to max_len bytes long and, unless mask is 0, its payload byte
+/// at offset ANDed with mask equals value
+struct vw_rx_rule
+{
+   uint8_t offset;
+   uint8_t mask;
+   uint8_t value;
+   uint8_t min_len;
+   uint8_t max_len;
+};
+
+/// Receive filter, see vw_set_rx_filter(). A message is queued if it
+/// matches any of the first count rules
+struct vw_rx_filter
+{
+   unsigned int count;
+   struct vw_rx_rule rule[VW_RX_FILTER_MAX];
+};
+
+/// Recently received messages remembered for vw_set_rx_dedup(), a power of 2
+#define VW_RX_DEDUP_SLOTS 16
+
+/// A message remembered to spot its retransmissions
+struct vw_rx_seen
+{
+   /// jiffies when it arrived
+   unsigned long time;
+   uint8_t len;
+   uint8_t buf[VW_MAX_MESSAGE_LEN];
+};
+
+/// Events of the receiver tap, see vw_set_rx_tap()
+/// The start symbol was seen
+#define VW_RX_TAP_START          1
+/// A message was dropped for its impossible byte count
+#define VW_RX_TAP_LENGTH_REJECT  2
+
+/// An encoded message waiting to be sent, as 6 bit symbols including
+/// the header
+struct vw_tx_frame
+{
+   uint8_t len;
+   uint8_t buf[(VW_MAX_MESSAGE_LEN * 2) + VW_HEADER_LEN];
+};
+
+/// Protocol counters of one channel, see vw_get_stats()
+struct vw_stats
+{
+   /// Start symbols seen
+   uint64_t rx_start;
+
+   /// Messages dropped for a byte count out of range
+   uint64_t rx_length_err;
+
+   /// Messages dropped for an invalid 6 bit symbol
+   uint64_t rx_symbol_err;
+
+   /// Complete messages with a bad FCS
+   uint64_t rx_crc_err;
+
+   /// Complete messages with a good FCS
+   uint64_t rx_good;
+
+   /// Messages overwritten before vw_get_message() got to them
+   uint64_t rx_overflow;
+
+   /// Messages sent
+   uint64_t tx_frames;
+
+   /// Time spent sending messages, in ns, see vw_set_tx_bit_time()
+   uint64_t tx_airtime_ns;
+
+   /// Messages refused by vw_send() because the queue was full
+   uint64_t tx_full;
+
+   /// Words of receiver samples lost because vw_rx_decode() fell behind
+   uint64_t rx_capture_lost;
+
+   /// Complete messages dropped by the receive filter
+   uint64_t rx_filtered;
+
+   /// Retransmitted messages dropped, see vw_set_rx_dedup()
+   uint64_t rx_duplicate;
+};
+
+/// All of the state of one radio channel: a receiver, a transmitter and
+/// their pins. Every function below works on one channel, so a single
+/// caller can drive several radios. Zero it, then call vw_init()
+struct vw_channel
+{
+   /// Channel number, used in GPIO labels
+   uint8_t id;
+
+   /// The receiver, transmitter, ptt and (optional) led pins
+   struct gpio receiver;
+   struct gpio transmitter;
+   struct gpio ptt;
+   struct gpio led;
+   char rx_label[8];
+   char tx_label[8];
+   char ptt_label[8];
+   char led_label[8];
+
+   /// Drive PTT low to transmit
+   uint8_t ptt_inverted;
+
+   /// Queue of encoded messages waiting to be sent
+   /// vw_send() is the only writer of tx_queue_head and the interrupt 
+   /// handler the only writer of tx_queue_tail, so neither side needs a
+   /// lock. The slot at the tail stays in the queue while it is being sent
+   struct vw_tx_frame tx_queue[VW_TX_QUEUE_MAX];
+   unsigned int tx_queue_len;
+   unsigned int tx_queue_head;
+   unsigned int tx_queue_tail;
+
+   /// The symbols of the message being sent, the slot at the queue tail
+   const uint8_t *tx_buf;
+
+   /// Number of symbols in tx_buf to be sent;
+   uint8_t tx_len;
+
+   /// Index of the next symbol to send. Ranges from 0 to tx_len
+   uint8_t tx_index;
+
+   /// Bit number of next bit to send
+   uint8_t tx_bit;
+
+   /// Sample number for the transmitter. Runs 0 to samples_per_bit-1 during
+   /// one bit interval
+   uint8_t tx_sample;
+
+   /// Flag to indicated the transmitter is active
+   volatile uint8_t tx_enabled;
+
+   /// Number of messages refused by vw_send() because the queue was full
+   uint32_t tx_full;
+
+   /// Length of one bit on the air, for the airtime counter
+   uint32_t tx_bit_ns;
+
+   /// Samples per bit, ie calls of vw_int_handler() per bit, and the PLL
+   /// constants for it. Set by vw_set_samples_per_bit()
+   uint8_t samples_per_bit;
+   uint8_t rx_ramp_inc;
+   uint8_t rx_ramp_inc_retard;
+   uint8_t rx_ramp_inc_advance;
+   uint8_t rx_integrator_threshold;
+   /// 65536 / rx_ramp_inc rounded up, for vw_pll_word()
+   uint16_t rx_ramp_recip;
+
+   /// Current receiver sample
+   uint8_t rx_sample;
+
+   /// Last receiver sample
+   uint8_t rx_last_sample;
+
+   /// PLL ramp, varies between 0 and VW_RX_RAMP_LEN-1 (159) over 
+   /// samples_per_bit (8) samples per nominal bit time. 
+   /// When the PLL is synchronised, bit transitions happen at about the
+   /// 0 mark. 
+   uint8_t rx_pll_ramp;
+
+   /// This is the integrate and dump integral. If there are fewer than
+   /// rx_integrator_threshold (5 of 8) 1 samples in the PLL cycle the bit
+   /// is declared a 0, else a 1
+   uint8_t rx_integrator;
+
+   /// Flag indictate if we have seen the start symbol of a new message and
+   /// are in the processes of reading and decoding it
+   uint8_t rx_active;
+
+   /// Flag to indicate the receiver PLL is to run
+   uint8_t rx_enabled;
+
+   /// Flag to indicate the receiver is fed from edge timestamps by
+   /// vw_rx_feed() instead of being sampled by vw_int_handler()
+   uint8_t rx_edge_mode;
+
+   /// Deferred decoding, see vw_set_rx_deferred(). vw_int_handler() only
+   /// packs the receiver samples into rx_capture_word, oldest in bit 0,
+   /// and appends each full word to rx_capture. vw_rx_decode() runs the
+   /// PLL over them later. vw_int_handler() is the only writer of
+   /// rx_capture_head and vw_rx_decode() the only writer of
+   /// rx_capture_tail, like the receive queue
+   uint8_t rx_deferred;
+   uint8_t rx_capture_bits;
+   uint32_t rx_capture_word;
+   uint32_t rx_capture[VW_RX_CAPTURE_WORDS];
+   unsigned int rx_capture_head;
+   unsigned int rx_capture_tail;
+
+   /// Words appended since rx_capture_callback was last called, and how
+   /// many it takes to call it again
+   unsigned int rx_capture_pending;
+   unsigned int rx_capture_batch;
+
+   /// Full words dropped because the capture ring was full
+   uint32_t rx_capture_lost;
+
+   /// Words dropped just before each word in rx_capture, so the PLL can
+   /// skip its clock over them, and the ones dropped since the last word
+   /// was appended
+   uint32_t rx_capture_skip[VW_RX_CAPTURE_WORDS];
+   uint32_t rx_capture_skipped;
+
+   /// Samples in the full words vw_int_handler() has captured, appended
+   /// or dropped, counted like rx_clock
+   uint32_t rx_capture_clock;
+
+   /// Samples the PLL has taken since vw_rx_start(), and the count at the
+   /// start of the start symbol of the message being received
+   uint32_t rx_clock;
+   uint32_t rx_start_clock;
+
+   /// Transitions since the start symbol, and the sum of how far each was
+   /// from the 0 mark of the ramp, for the quality of the message
+   uint16_t rx_transitions;
+   uint32_t rx_phase_err;
+
+   /// Last 12 bits received, so we can look for the start symbol
+   uint16_t rx_bits;
+
+   /// How many bits of message we have received. Ranges from 0 to 12
+   uint8_t rx_bit_count;
+
+   /// The incoming message buffer
+   uint8_t rx_buf[VW_MAX_MESSAGE_LEN];
+
+   /// The incoming message expected length
+   uint8_t rx_count;
+
+   /// The incoming message buffer length received so far
+   uint8_t rx_len;
+
+   /// CRC of the bytes of the incoming message received so far
+   uint16_t rx_crc;
+
+   /// The receive queue, rx_ring_own unless vw_set_rx_ring() gave another
+   struct vw_rx_ring *rx_ring;
+   struct vw_rx_ring rx_ring_own;
+
+   /// The reader of vw_get_message()
+   struct vw_rx_cursor rx_reader;
+
+   /// Messages not matching it are counted and dropped before they are
+   /// queued, NULL to queue them all. Read by the PLL under RCU, see
+   /// vw_set_rx_filter()
+   const struct vw_rx_filter __rcu *rx_filter;
+
+   /// Good messages seen less than rx_dedup_window jiffies ago are
+   /// dropped, 0 to keep them. rx_seen is hashed by FCS and only used by
+   /// the PLL
+   unsigned long rx_dedup_window;
+   struct vw_rx_seen rx_seen[VW_RX_DEDUP_SLOTS];
+
+   /// Counters since vw_init(). The receive side is only written by the
+   /// PLL and the transmit side only by the interrupt handler, each under
+   /// its own u64_stats_sync so they can be read on 32 bit machines
+   struct vw_stats stats;
+   struct u64_stats_sync rx_syncp;
+   struct u64_stats_sync tx_syncp;
+
+   /// Counters at the last vw_reset_stats()
+   struct vw_stats stats_base;
+
+   /// Called from interrupt level when a message has been queued
+   void (*rx_callback)(struct vw_channel *ch);
+
+   /// Called from interrupt level when the transmitter has gone idle
+   void (*tx_callback)(struct vw_channel *ch);
+
+   /// Called from interrupt level every rx_capture_batch captured words
+   void (*rx_capture_callback)(struct vw_channel *ch);
+
+   /// Called from the PLL to timestamp each queued message
+   uint64_t (*rx_timestamp)(struct vw_channel *ch, uint32_t samples_ago);
+
+   /// Called from the PLL with every sample it takes and on each
+   /// VW_RX_TAP_* event, while vw_rx_tapped() is true. See vw_set_rx_tap()
+   void (*rx_tap)(struct vw_channel *ch, uint32_t samples, unsigned int count);
+   void (*rx_tap_event)(struct vw_channel *ch, unsigned int event);
+
+   /// Decoders for other baud rates, fed from the samples this channel's
+   /// PLL takes. See vw_add_rx_rate()
+   struct vw_channel *rx_rate[VW_RX_RATES_MAX];
+   unsigned int rx_rates;
+
+   /// In such a decoder, the channel it is fed by, and every how many of
+   /// its samples it takes, 0 for none. rx_step_count is the number to
+   /// skip before the next one, and rx_parent_clock the channel's
+   /// rx_clock at this decoder's rx_clock 0, for the timestamps
+   struct vw_channel *rx_parent;
+   unsigned int rx_step;
+   unsigned int rx_step_count;
+   uint32_t rx_parent_clock;
+
+   /// For the owner of the channel, not used here
+   void *priv;
+};
+
+/// Initialise a zeroed channel
+/// \param[in] ch The channel
+/// \param[in] id Channel number, used in GPIO labels
+extern void vw_init(struct vw_channel *ch, uint8_t id);
+
 /// Set the digital IO pin to be for transmit data. 
 /// This pin will only be accessed if
 /// the transmitter is enabled
 /// \param[in] pin The Arduino pin number for transmitting data. Defaults to 12.
-extern void vw_set_tx_pin(uint8_t pin);
+extern void vw_set_tx_pin(struct vw_channel *ch, uint8_t pin);
 
 /// Set the digital IO pin to be for receive data.
 /// This pin will only be accessed if
 /// the receiver is enabled
 /// \param[in] pin The Arduino pin number for receiving data. Defaults to 11.
-extern void vw_set_rx_pin(uint8_t pin);
+extern void vw_set_rx_pin(struct vw_channel *ch, uint8_t pin);
 
 // Set the digital IO pin to enable the transmitter (press to talk, PTT)'
 /// This pin will only be accessed if
 /// the transmitter is enabled
 /// \param[in] pin The Arduino pin number to enable the transmitter. Defaults to 10.
-extern void vw_set_ptt_pin(uint8_t pin);
+extern void vw_set_ptt_pin(struct vw_channel *ch, uint8_t pin);
 
 // Set the digital IO pin to enable a status LED
-extern void vw_set_led_pin(uint8_t pin);
+extern void vw_set_led_pin(struct vw_channel *ch, uint8_t pin);
 
-// Set verbose debugging 
-extern void vw_set_verbose_debug(uint8_t val);
+/// Set the number of vw_int_handler() or vw_rx_feed() samples per bit,
+/// VW_RX_SAMPLES_PER_BIT_MIN, VW_RX_SAMPLES_PER_BIT or
+/// VW_RX_SAMPLES_PER_BIT_MAX. Fewer samples cost less CPU for the same
+/// baud rate, more tolerate more timing jitter and noise. With
+/// VW_RX_SAMPLES_PER_BIT_MIN one flipped sample moves the PLL by a large
+/// part of a bit, so it is only good for clean links
+/// Only call it while vw_int_handler() can not run
+/// \return true if spb is supported
+extern uint8_t vw_set_samples_per_bit(struct vw_channel *ch, uint8_t spb);
+
+/// Set the depth of the received message queue. Rounded down to a power
+/// of 2 and limited to VW_RX_QUEUE_MAX. Empties the queue.
+/// \param[in] len Number of messages that can wait for vw_get_message()
+extern void vw_set_rx_queue_len(struct vw_channel *ch, unsigned int len);
+
+/// Keep the receive queue in ring instead of in the channel, for example
+/// in memory that readers can map. Keeps the queue length and empties the
+/// queue, so only call it while the receiver is stopped
+/// \param[in] ring Zeroed ring that outlives its use here, NULL to go
+/// back to the channel's own
+extern void vw_set_rx_ring(struct vw_channel *ch, struct vw_rx_ring *ring);
+
+/// Set the depth of the transmit queue. Rounded down to a power of 2 and
+/// limited to VW_TX_QUEUE_MAX. Empties the queue.
+/// \param[in] len Number of messages that can wait to be sent
+extern void vw_set_tx_queue_len(struct vw_channel *ch, unsigned int len);
+
+/// \return Number of messages waiting to be sent, including the one being sent
+extern unsigned int vw_tx_queue_count(struct vw_channel *ch);
+
+/// \return true if there is no room for another message in the transmit queue
+extern uint8_t vw_tx_queue_full(struct vw_channel *ch);
+
+/// Get the protocol counters since the last vw_reset_stats(), those of
+/// the decoders added with vw_add_rx_rate() included
+/// \param[out] stats The counters
+extern void vw_get_stats(struct vw_channel *ch, struct vw_stats *stats);
+
+/// Start the counters returned by vw_get_stats() again from 0. Safe to
+/// call while the channel is running, but not concurrently with itself
+extern void vw_reset_stats(struct vw_channel *ch);
+
+/// Set the length of one bit on the air, used to count airtime
+/// \param[in] ns Bit time in nanoseconds
+extern void vw_set_tx_bit_time(struct vw_channel *ch, uint32_t ns);
+
+/// Set the functions called at interrupt level when a message has been
+/// queued and when the transmitter has become idle. Either may be NULL.
+/// \param[in] rx_done Called after each received message
+/// \param[in] tx_done Called after each transmitted message
+extern void vw_set_callbacks(struct vw_channel *ch,
+                             void (*rx_done)(struct vw_channel *ch),
+                             void (*tx_done)(struct vw_channel *ch));
+
+/// Set the receive filter. Messages that do not match it are dropped by
+/// the PLL without being queued or waking a reader. The PLL may still be
+/// using the old filter until an RCU grace period has passed, so free it
+/// only after synchronize_rcu(). One caller at a time
+/// \param[in] filter The new filter, NULL to queue every message
+/// \return The old filter
+extern const struct vw_rx_filter *vw_set_rx_filter(struct vw_channel *ch,
+                                                   const struct vw_rx_filter *filter);
+
+/// Drop retransmissions: a message with a good FCS that is the same as one
+/// received less than window ago is counted and not queued. The copies
+/// are compared whole, so two different messages are never mixed up.
+/// May be called while the channel is running
+/// \param[in] window In jiffies, 0 to queue every copy
+extern void vw_set_rx_dedup(struct vw_channel *ch, unsigned long window);
+
+/// Set the function that timestamps received messages. It is called from
+/// the PLL, at interrupt level unless in deferred mode, once for each
+/// message queued, and has to return the time of the receiver sample
+/// taken samples_ago samples before the latest one. NULL for no timestamps
+extern void vw_set_rx_timestamp(struct vw_channel *ch,
+                                uint64_t (*stamp)(struct vw_channel *ch, uint32_t samples_ago));
+
+/// Tap the receiver input, to record what the PLL was given. tap is
+/// called with the samples in the order the PLL takes them, up to 32 at
+/// a time with the oldest in bit 0 and the bits above count undefined,
+/// before the PLL runs over them. event is called with a VW_RX_TAP_*
+/// value while the PLL is in the middle of those samples. Both run where
+/// the PLL does, and only while vw_rx_tapped() is true, so a tap that is
+/// switched off costs nothing. Only call it while the PLL can not run
+extern void vw_set_rx_tap(struct vw_channel *ch,
+                          void (*tap)(struct vw_channel *ch, uint32_t samples, unsigned int count),
+                          void (*event)(struct vw_channel *ch, unsigned int event));
+
+/// Time the sample the PLL counted as rx_clock was taken, from the
+/// rx_timestamp function, or 0 without one. Only call it from the PLL,
+/// for a sample it has already taken
+extern uint64_t vw_rx_sample_time(struct vw_channel *ch, uint32_t clock);
+
+/// Decode another baud rate from the receiver samples of ch as well: rate
+/// runs a PLL of its own over every vw_set_rx_step()'th sample ch's PLL
+/// takes, and queues what it receives in ch's receive queue, tagged with
+/// its vw_set_tx_bit_time() in vw_rx_meta.baud. It uses ch's callbacks,
+/// timestamps, priv, filter and dedup window, and starts, stops and
+/// counts along with ch. Its own pins, transmitter and tap are not used.
+/// Only call it while the receiver is stopped, after those are set up
+/// \param[in] rate Zeroed channel, the caller keeps it until ch is shut down
+/// \return false if ch already has VW_RX_RATES_MAX of them
+extern uint8_t vw_add_rx_rate(struct vw_channel *ch, struct vw_channel *rate);
+
+/// Set every how many samples of its channel a decoder added with
+/// vw_add_rx_rate() takes. Its baud rate times its samples per bit times
+/// step has to be the sampling rate of the channel.
+/// Only call it while the receiver is stopped
+/// \param[in] step 1 for every sample, 0 to switch the decoder off
+extern void vw_set_rx_step(struct vw_channel *rate, unsigned int step);
+
+/// Select edge driven reception instead of sampling the receiver pin
+/// from vw_int_handler()
+/// \param[in] enable True to take receiver samples from vw_rx_feed() only
+extern void vw_set_rx_edge_mode(struct vw_channel *ch, uint8_t enable);
+
+/// Select deferred decoding: vw_int_handler() only captures the receiver
+/// samples, and the caller runs the PLL over them with vw_rx_decode(),
+/// outside of the interrupt. Only call it while vw_int_handler() can not run
+/// \param[in] batch Call ready after this many words of 32 samples, 1 to
+/// VW_RX_CAPTURE_WORDS, or 0 to decode from vw_int_handler() again
+/// \param[in] ready Called at interrupt level when a batch is waiting
+extern void vw_set_rx_deferred(struct vw_channel *ch, unsigned int batch,
+                               void (*ready)(struct vw_channel *ch));
+
+/// Run the PLL over the samples captured since the last call, in
+/// deferred mode. Messages are queued and rx_callback called from here.
+/// Only one caller at a time
+/// \return The number of words of 32 samples decoded
+extern unsigned int vw_rx_decode(struct vw_channel *ch);
 
 /// By default the PTT pin goes high when the transmitter is enabled.
 /// This flag forces it low when the transmitter is enabled.
 /// \param[in] inverted True to invert PTT
-extern void vw_set_ptt_inverted(uint8_t inverted);
+extern void vw_set_ptt_inverted(struct vw_channel *ch, uint8_t inverted);
 
 /// Initialise the VirtualWire software, to operate at speed bits per second
 /// Call this one in your setup() after any vw_set_* calls
 /// Must call vw_rx_start() before you will get any messages
-extern  int vw_setup(void);
+extern  int vw_setup(struct vw_channel *ch);
 
 /// Cleanup all of the gpios.  Cannot be called externally.
-void vw_cleanup(void);
+void vw_cleanup(struct vw_channel *ch);
 
 /// Start the Phase Locked Loop listening to the receiver
 /// Must do this before you can receive any messages
 /// When a message is available (good checksum or not), vw_have_message();
 /// will return true.
-extern void vw_rx_start(void);
+extern void vw_rx_start(struct vw_channel *ch);
 
 /// Stop the Phase Locked Loop listening to the receiver
 /// No messages will be received until vw_rx_start() is called again
 /// Saves interrupt processing cycles
-extern void vw_rx_stop(void);
+extern void vw_rx_stop(struct vw_channel *ch);
 
 /// Returns the state of the
 /// transmitter
 /// \return true if the transmitter is active else false
-extern uint8_t vx_tx_active(void);
+extern uint8_t vx_tx_active(struct vw_channel *ch);
 
-/// Block until the transmitter is idle
+/// Block until the transmitter is idle and the queue is empty
 /// then returns
-extern void vw_wait_tx(void);
+extern void vw_wait_tx(struct vw_channel *ch);
 
 /// Block until a message is available
 /// then returns
-extern void vw_wait_rx(void);
+extern void vw_wait_rx(struct vw_channel *ch);
 
 /// Block until a message is available or for a max time
 /// \param[in] milliseconds Maximum time to wait in milliseconds.
 /// \return true if a message is available, false if the wait timed out.
-extern uint8_t vw_wait_rx_max(unsigned long milliseconds);
+extern uint8_t vw_wait_rx_max(struct vw_channel *ch, unsigned long milliseconds);
 
-/// Send a message with the given length. Returns almost immediately,
+/// Queue a message with the given length. Returns immediately,
 /// and message will be sent at the right timing by interrupts
 /// \param[in] buf Pointer to the data to transmit
 /// \param[in] len Number of octetes to transmit
 /// \return true if the message was accepted for transmission, false if the message is too long (>VW_MAX_MESSAGE_LEN - 3)
-extern uint8_t vw_send(const uint8_t* buf, uint8_t len);
+/// or the transmit queue is full
+extern uint8_t vw_send(struct vw_channel *ch, const uint8_t* buf, uint8_t len);
 
 // Returns true if an unread message is available
 /// \return true if a message is available to read
-extern uint8_t vw_have_message(void);
+extern uint8_t vw_have_message(struct vw_channel *ch);
+
+/// Start a new reader of the receive queue at the next message to arrive
+extern void vw_rx_cursor_init(struct vw_channel *ch, struct vw_rx_cursor *cur);
+
+/// \return true if there is a message cur has not read yet
+extern uint8_t vw_rx_cursor_have(struct vw_channel *ch, const struct vw_rx_cursor *cur);
+
+/// As vw_get_message() for one of several readers. The message stays in
+/// the queue for the others. If the reader fell more than the queue
+/// length behind, the messages it missed are added to cur->dropped and
+/// it goes on with the oldest one still there. Any number of readers
+/// can run at once, each cursor has to be used by one at a time
+/// \param[out] meta Timestamp, FCS and quality of the message, may be NULL
+/// \return true if there was a message and the checksum was good
+extern uint8_t vw_rx_cursor_get(struct vw_channel *ch, struct vw_rx_cursor *cur,
+                                uint8_t* buf, uint8_t* len, struct vw_rx_meta *meta);
 
 // If a message is available (good checksum or not), copies
-// up to *len octets to buf.
+// up to *len octets of the oldest one to buf and moves past it.
 /// \param[in] buf Pointer to location to save the read data (must be at least *len bytes.
 /// \param[in,out] len Available space in buf. Will be set to the actual number of octets read
 /// \return true if there was a message and the checksum was good
-extern uint8_t vw_get_message(uint8_t* buf, uint8_t* len);
+extern uint8_t vw_get_message(struct vw_channel *ch, uint8_t* buf, uint8_t* len);
+
+
+/// Run the PLL over a number of identical receiver samples (edge mode)
+/// \param[in] sample The receiver pin level during those samples
+/// \param[in] count Number of sample periods the level was held
+extern void vw_rx_feed(struct vw_channel *ch, uint8_t sample, unsigned int count);
+
+/// \return true if a message is partially received, at any rate
+extern uint8_t vw_rx_in_progress(struct vw_channel *ch);
+
+void vw_pll(struct vw_channel *ch);
 
+/// Run the PLL over a word of receiver samples, as count calls of vw_pll()
+/// would, but with one step per transition or bit instead of per sample
+/// \param[in] samples The receiver samples, the oldest in bit 0
+/// \param[in] count Number of samples in the word, 1 to 32
+void vw_pll_word(struct vw_channel *ch, uint32_t samples, unsigned int count);
+void vw_tx_start(struct vw_channel *ch);
+void vw_tx_stop(struct vw_channel *ch);
 
-void vw_pll(void);
-void vw_tx_start(void);
-void vw_tx_stop(void);
+extern void vw_int_handler(struct vw_channel *ch);
 
-extern void vw_int_handler(void);
-extern void vw_shutdown(void);
+/// Abort the message being sent, it is sent again from its start the next
+/// time vw_int_handler() runs. Only call it while vw_int_handler() can not
+/// run
+extern void vw_tx_rewind(struct vw_channel *ch);
+extern void vw_shutdown(struct vw_channel *ch);
 
 
 #endif  /* vwire_h */
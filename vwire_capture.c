@@ -0,0 +1,351 @@
+/*
+ * VirtualWire kernel driver
+ *
+ * Raw receiver sample capture, see vwire_capture.h.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <linux/jiffies.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/seq_file.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+
+#include "vwire_config.h"
+#include "vwire.h"
+#include "vwire_uapi.h"
+#include "vwire_capture.h"
+
+#define VWIRE_CAPTURE_HDR_WORDS   (sizeof(struct vwire_capture_hdr) / sizeof(u32))
+
+/* most ring words one capture takes */
+#define VWIRE_CAPTURE_SHOT_WORDS  (VWIRE_CAPTURE_HDR_WORDS + VWIRE_CAPTURE_PRE_WORDS \
+                                   + VWIRE_CAPTURE_POST_WORDS)
+
+DEFINE_STATIC_KEY_FALSE(vwire_capture_enabled);
+
+/* Only one channel is captured at a time, and its PLL never runs on two
+ * CPUs at once, so the ring has one writer: the tap.  It only publishes
+ * whole captures, read() is the one consumer. */
+struct vwire_capture_state {
+   /* set before the static key is switched on, fixed while it is */
+   u8             chan;
+   u8             trigger;       /* VWIRE_CAPTURE_* that start a capture */
+   u32           *ring;          /* VWIRE_CAPTURE_RING_WORDS */
+
+   /* the tap's own */
+   u32            word;          /* samples packed so far, oldest in bit 0 */
+   unsigned int   bits;
+   u32            clock;         /* rx_clock of the sample after them */
+   u32            hist[VWIRE_CAPTURE_PRE_WORDS];  /* the latest full words */
+   unsigned int   hist_count;    /* full words so far, indexes hist */
+   unsigned int   pos;           /* end of the capture being written */
+   unsigned int   left;          /* words it still takes, 0 if none */
+   unsigned long  next;          /* jiffies from which another may start */
+
+   unsigned int   head;          /* end of the captures published */
+   unsigned int   tail;          /* what read() has got to */
+
+   /* off by a capture at most when read while the tap runs */
+   unsigned long  taken;
+   unsigned long  limited;       /* triggers ignored for the rate limit */
+   unsigned long  dropped;       /* triggers with no room in the ring */
+};
+
+static struct vwire_capture_state vwire_capture;
+static DEFINE_MUTEX(vwire_capture_lock);   /* arming and read() */
+static bool vwire_capture_closed;          /* the module is going */
+static DECLARE_WAIT_QUEUE_HEAD(vwire_capture_wait);
+
+static void vwire_capture_put(struct vwire_capture_state *cap, u32 word)
+{
+   cap->ring[cap->pos++ & (VWIRE_CAPTURE_RING_WORDS - 1)] = word;
+}
+
+static void vwire_capture_word(struct vwire_capture_state *cap, u32 word)
+{
+   cap->hist[cap->hist_count++ & (VWIRE_CAPTURE_PRE_WORDS - 1)] = word;
+   if (!cap->left)
+      return;
+
+   vwire_capture_put(cap, word);
+   if (--cap->left == 0) {
+      /* pairs with the acquire in read() */
+      smp_store_release(&cap->head, cap->pos);
+      wake_up_interruptible(&vwire_capture_wait);
+   }
+}
+
+void vwire_capture_tap(struct vw_channel *ch, u32 samples, unsigned int count)
+{
+   struct vwire_capture_state *cap = &vwire_capture;
+   unsigned int room = 32 - cap->bits;
+
+   if (ch->id != cap->chan)
+      return;
+
+   cap->clock = ch->rx_clock + count;
+   if (count < 32)
+      samples &= (1u << count) - 1;
+   cap->word |= samples << cap->bits;
+   if (count < room) {
+      cap->bits += count;
+      return;
+   }
+
+   vwire_capture_word(cap, cap->word);
+   cap->word = room < 32 ? samples >> room : 0;
+   cap->bits = count - room;
+}
+
+/* Start a capture with the words kept from before the trigger, the tap
+ * adds the rest as they fill up */
+void vwire_capture_event(struct vw_channel *ch, unsigned int event)
+{
+   struct vwire_capture_state *cap = &vwire_capture;
+   u8 trigger = (event == VW_RX_TAP_START) ? VWIRE_CAPTURE_START : VWIRE_CAPTURE_REJECT;
+   struct vwire_capture_hdr hdr;
+   const u32 *hdr_words = (const u32 *)&hdr;
+   unsigned int pre, i;
+   u32 first;
+
+   /* a trigger during a capture is part of it */
+   if (ch->id != cap->chan || !(cap->trigger & trigger) || cap->left)
+      return;
+
+   if (time_before(jiffies, cap->next)) {
+      cap->limited++;
+      return;
+   }
+   if (VWIRE_CAPTURE_RING_WORDS - (cap->pos - smp_load_acquire(&cap->tail))
+         < VWIRE_CAPTURE_SHOT_WORDS) {
+      cap->dropped++;
+      return;
+   }
+   cap->next = jiffies + max(HZ / VWIRE_CAPTURE_PER_SEC, 1);
+   cap->taken++;
+
+   pre = min_t(unsigned int, cap->hist_count, VWIRE_CAPTURE_PRE_WORDS);
+   first = cap->clock - cap->bits - pre * 32;
+
+   memset(&hdr, 0, sizeof(hdr));
+   hdr.magic = VWIRE_CAPTURE_MAGIC;
+   hdr.chan = ch->id;
+   hdr.trigger = trigger;
+   hdr.spb = ch->samples_per_bit;
+   hdr.words = pre + VWIRE_CAPTURE_POST_WORDS;
+   hdr.trigger_at = ch->rx_clock - first;
+   hdr.ts_ns = vw_rx_sample_time(ch, first);
+   hdr.sample_ns = ch->tx_bit_ns / ch->samples_per_bit;
+
+   for (i = 0; i < VWIRE_CAPTURE_HDR_WORDS; i++)
+      vwire_capture_put(cap, hdr_words[i]);
+   for (i = cap->hist_count - pre; i != cap->hist_count; i++)
+      vwire_capture_put(cap, cap->hist[i & (VWIRE_CAPTURE_PRE_WORDS - 1)]);
+   cap->left = VWIRE_CAPTURE_POST_WORDS;
+}
+
+/* Called with vwire_capture_lock held */
+static void vwire_capture_disarm(void)
+{
+   struct vwire_capture_state *cap = &vwire_capture;
+   u32 *ring = cap->ring;
+
+   if (!ring)
+      return;
+
+   static_branch_disable(&vwire_capture_enabled);
+   /* the PLL runs with preemption off, none is left in the tap after this */
+   synchronize_rcu();
+
+   WRITE_ONCE(cap->ring, NULL);
+   vfree(ring);
+   wake_up_interruptible(&vwire_capture_wait);
+}
+
+/* Called with vwire_capture_lock held */
+static int vwire_capture_arm(u8 chan, u8 trigger)
+{
+   struct vwire_capture_state *cap = &vwire_capture;
+   u32 *ring;
+
+   vwire_capture_disarm();
+   if (vwire_capture_closed)
+      return -ENODEV;
+
+   ring = vmalloc(VWIRE_CAPTURE_RING_WORDS * sizeof(u32));
+   if (!ring)
+      return -ENOMEM;
+
+   memset(cap, 0, sizeof(*cap));
+   cap->chan = chan;
+   cap->trigger = trigger;
+   cap->next = jiffies;
+   cap->ring = ring;
+
+   static_branch_enable(&vwire_capture_enabled);
+   return 0;
+}
+
+/* Whole words only, as many as there are up to count bytes.  Sleeps while
+ * there are none, returns 0 once the capture is switched off. */
+static ssize_t vwire_capture_read(struct file *file, char __user *ubuf,
+                                  size_t count, loff_t *ppos)
+{
+   struct vwire_capture_state *cap = &vwire_capture;
+   unsigned int head, tail, n, chunk;
+   ssize_t ret = 0;
+
+   if (count < sizeof(u32))
+      return -EINVAL;
+
+   for (;;) {
+      if (mutex_lock_interruptible(&vwire_capture_lock))
+         return -ERESTARTSYS;
+      if (!cap->ring) {
+         mutex_unlock(&vwire_capture_lock);
+         return 0;
+      }
+      tail = cap->tail;
+      head = smp_load_acquire(&cap->head);
+      if (head != tail)
+         break;
+      mutex_unlock(&vwire_capture_lock);
+
+      if (file->f_flags & O_NONBLOCK)
+         return -EAGAIN;
+      if (wait_event_interruptible(vwire_capture_wait,
+               smp_load_acquire(&cap->head) != READ_ONCE(cap->tail)
+               || !READ_ONCE(cap->ring)))
+         return -ERESTARTSYS;
+   }
+
+   n = min_t(size_t, head - tail, count / sizeof(u32));
+   while (n > 0) {
+      chunk = min(n, VWIRE_CAPTURE_RING_WORDS - (tail & (VWIRE_CAPTURE_RING_WORDS - 1)));
+      if (copy_to_user(ubuf + ret, &cap->ring[tail & (VWIRE_CAPTURE_RING_WORDS - 1)],
+                       chunk * sizeof(u32))) {
+         if (!ret)
+            ret = -EFAULT;
+         break;
+      }
+      ret += chunk * sizeof(u32);
+      tail += chunk;
+      n -= chunk;
+   }
+   /* hand the words back to the tap */
+   smp_store_release(&cap->tail, tail);
+
+   mutex_unlock(&vwire_capture_lock);
+   return ret;
+}
+
+/* "start N", "reject N" or "any N" arms channel N, 0 if left out, to
+ * capture at the start symbol, a length reject or both; "off" disarms and
+ * frees what was not read */
+static ssize_t vwire_capture_write(struct file *file, const char __user *ubuf,
+                                   size_t count, loff_t *ppos)
+{
+   char buf[32], what[8];
+   unsigned int chan = 0;
+   u8 trigger;
+   int ret;
+
+   if (count >= sizeof(buf))
+      return -EINVAL;
+   if (copy_from_user(buf, ubuf, count))
+      return -EFAULT;
+   buf[count] = '\0';
+
+   if (sscanf(buf, "%7s %u", what, &chan) < 1 || chan > U8_MAX)
+      return -EINVAL;
+
+   if (!strcmp(what, "start"))
+      trigger = VWIRE_CAPTURE_START;
+   else if (!strcmp(what, "reject"))
+      trigger = VWIRE_CAPTURE_REJECT;
+   else if (!strcmp(what, "any"))
+      trigger = VWIRE_CAPTURE_START | VWIRE_CAPTURE_REJECT;
+   else if (!strcmp(what, "off"))
+      trigger = 0;
+   else
+      return -EINVAL;
+
+   mutex_lock(&vwire_capture_lock);
+   if (trigger)
+      ret = vwire_capture_arm(chan, trigger);
+   else {
+      vwire_capture_disarm();
+      ret = 0;
+   }
+   mutex_unlock(&vwire_capture_lock);
+
+   return ret ? ret : count;
+}
+
+static const struct file_operations vwire_capture_fops = {
+   .owner   = THIS_MODULE,
+   .open    = nonseekable_open,
+   .read    = vwire_capture_read,
+   .write   = vwire_capture_write,
+   .llseek  = no_llseek,
+};
+
+static int vwire_capture_show(struct seq_file *m, void *v)
+{
+   struct vwire_capture_state *cap = &vwire_capture;
+
+   mutex_lock(&vwire_capture_lock);
+   seq_printf(m, "armed %d\n", cap->ring ? 1 : 0);
+   seq_printf(m, "chan %u\n", cap->chan);
+   seq_printf(m, "trigger %s%s\n",
+         (cap->trigger & VWIRE_CAPTURE_START) ? "start " : "",
+         (cap->trigger & VWIRE_CAPTURE_REJECT) ? "reject" : "");
+   seq_printf(m, "taken %lu\n", READ_ONCE(cap->taken));
+   seq_printf(m, "limited %lu\n", READ_ONCE(cap->limited));
+   seq_printf(m, "dropped %lu\n", READ_ONCE(cap->dropped));
+   seq_printf(m, "unread_words %u\n", smp_load_acquire(&cap->head) - cap->tail);
+   mutex_unlock(&vwire_capture_lock);
+   return 0;
+}
+
+static int vwire_capture_status_open(struct inode *inode, struct file *file)
+{
+   return single_open(file, vwire_capture_show, NULL);
+}
+
+static const struct file_operations vwire_capture_status_fops = {
+   .owner   = THIS_MODULE,
+   .open    = vwire_capture_status_open,
+   .read    = seq_read,
+   .llseek  = seq_lseek,
+   .release = single_release,
+};
+
+void vwire_capture_init(struct dentry *dir)
+{
+   /* the header goes through the ring as words, which wrap with a mask */
+   BUILD_BUG_ON(sizeof(struct vwire_capture_hdr) % sizeof(u32));
+   BUILD_BUG_ON(VWIRE_CAPTURE_RING_WORDS & (VWIRE_CAPTURE_RING_WORDS - 1));
+   BUILD_BUG_ON(VWIRE_CAPTURE_PRE_WORDS & (VWIRE_CAPTURE_PRE_WORDS - 1));
+
+   debugfs_create_file("capture", S_IRUSR | S_IWUSR, dir, NULL, &vwire_capture_fops);
+   debugfs_create_file("capture_status", S_IRUSR, dir, NULL, &vwire_capture_status_fops);
+}
+
+void vwire_capture_cleanup(void)
+{
+   mutex_lock(&vwire_capture_lock);
+   vwire_capture_closed = true;
+   vwire_capture_disarm();
+   mutex_unlock(&vwire_capture_lock);
+}
@@ -0,0 +1,35 @@
+/*
+ * VirtualWire kernel driver
+ *
+ * Capture of the raw receiver samples of one channel, as the PLL takes
+ * them, for looking at bad reception offline.  Armed through debugfs
+ * vwire/capture with a trigger, each trigger then records the samples
+ * around it and the file streams them, see struct vwire_capture_hdr.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation.
+ */
+
+#ifndef vwire_capture_h
+#define vwire_capture_h
+
+#include <linux/jump_label.h>
+
+struct dentry;
+struct vw_channel;
+
+/* on only while a capture is armed, the PLL otherwise only pays for a
+ * patched-out branch, see vw_rx_tapped() */
+DECLARE_STATIC_KEY_FALSE(vwire_capture_enabled);
+
+/* the receiver tap of every channel, see vw_set_rx_tap() */
+extern void vwire_capture_tap(struct vw_channel *ch, u32 samples, unsigned int count);
+extern void vwire_capture_event(struct vw_channel *ch, unsigned int event);
+
+extern void vwire_capture_init(struct dentry *dir);
+
+/* disarm for good and free the ring, which also ends a read() waiting,
+ * before the debugfs files go */
+extern void vwire_capture_cleanup(void);
+
+#endif
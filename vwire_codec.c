@@ -0,0 +1,65 @@
+// vwire_codec.c
+//
+// Table driven 4-to-6 bit symbol codec and CRC-CCITT for Virtual Wire
+//
+// Replaces the linear search over the symbol table that was done twice
+// for every received byte and the byte at a time CRC of crc16.h
+// GPL2
+
+#include "vwire_port.h"
+
+#include "vwire_codec.h"
+#include "crc16.h"
+
+// 4 bit to 6 bit symbol converter table
+// Used to convert the high and low nybbles of the transmitted data
+// into 6 bit symbols for transmission. Each 6-bit symbol has 3 1s and 3 0s 
+// with at most 3 consecutive identical bits
+const uint8_t vw_symbols[16] =
+{
+   0xd,  0xe,  0x13, 0x15, 0x16, 0x19, 0x1a, 0x1c, 
+   0x23, 0x25, 0x26, 0x29, 0x2a, 0x2c, 0x32, 0x34
+};
+
+uint16_t vw_decode_table[4096];
+uint16_t vw_crc_table[256];
+
+void vw_codec_init(void)
+{
+   uint8_t reverse[64];
+   unsigned int i;
+
+   // 64 byte reverse lookup of the 6 bit symbols, 0xff for the invalid ones
+   memset(reverse, 0xff, sizeof(reverse));
+   for (i = 0; i < 16; i++)
+      reverse[vw_symbols[i]] = i;
+
+   // Symbols are received LSB first, so the first (high nybble) symbol
+   // ends up in the 6 lsbits of the pair
+   for (i = 0; i < 4096; i++)
+   {
+      uint8_t hi = reverse[i & 0x3f];
+      uint8_t lo = reverse[i >> 6];
+
+      if (hi == 0xff || lo == 0xff)
+         vw_decode_table[i] = VW_CODEC_INVALID;
+      else
+         vw_decode_table[i] = (hi << 4) | lo;
+   }
+
+   // The CCITT update is linear, so a byte's contribution does not depend
+   // on the high byte of the running CRC
+   for (i = 0; i < 256; i++)
+      vw_crc_table[i] = _crc_ccitt_update(0, i);
+}
+
+// Compute CRC over count bytes.
+uint16_t vw_crc(const uint8_t *ptr, uint8_t count)
+{
+   uint16_t crc = 0xffff;
+
+   while (count-- > 0) {
+      crc = vw_crc_update(crc, *ptr++);
+   }
+   return crc;
+}
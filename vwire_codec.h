@@ -0,0 +1,45 @@
+// vwire_codec.h
+//
+// Table driven 4-to-6 bit symbol codec and CRC-CCITT for Virtual Wire
+//
+// The decode and CRC tables are built once by vw_codec_init(), which has
+// to be called before any channel is started.
+// GPL2
+
+#ifndef vwire_codec_h
+#define vwire_codec_h
+
+/// Set in a vw_decode_table[] entry when either 6 bit symbol of the pair
+/// is not one of the 16 valid symbols
+#define VW_CODEC_INVALID 0x100
+
+/// 4 bit to 6 bit symbol converter table
+extern const uint8_t vw_symbols[16];
+
+/// Decoded byte for every 12 bit symbol pair as received, the 6 lsbits
+/// being the high nybble, or VW_CODEC_INVALID
+extern uint16_t vw_decode_table[4096];
+
+/// CRC-CCITT (reflected, polynomial 0x8408) of every byte value
+extern uint16_t vw_crc_table[256];
+
+/// Build the tables
+extern void vw_codec_init(void);
+
+/// Decode 12 received bits to a byte in one lookup
+/// \return The byte, with VW_CODEC_INVALID set if a symbol was corrupt
+static inline uint16_t vw_decode_symbols(uint16_t bits)
+{
+   return vw_decode_table[bits & 0xfff];
+}
+
+/// Add one byte to a CRC, same result as _crc_ccitt_update()
+static inline uint16_t vw_crc_update(uint16_t crc, uint8_t data)
+{
+   return (crc >> 8) ^ vw_crc_table[(uint8_t)(crc ^ data)];
+}
+
+/// Compute the CRC over count bytes, starting from 0xffff
+extern uint16_t vw_crc(const uint8_t *ptr, uint8_t count);
+
+#endif
@@ -10,6 +10,9 @@
 /* The textual part of the device name in /dev */
 #define VWIRE_DEV_NAME     "vwire"
 
+/* most radio channels one module instance drives */
+#define VWIRE_MAX_CHANNELS        (8)
+
 #define VWIRE_DEFAULT_BAUD_RATE   (2000)
 #define VWIRE_DEFAULT_RX_GPIO     (13)
 #define VWIRE_DEFAULT_TX_GPIO     (16)
@@ -17,16 +20,59 @@
 #define VWIRE_DEFAULT_PTT_GPIO    (0)
 #define VWIRE_DEFAULT_PTT_INVERT  (0)
 #define VWIRE_DEFAULT_VERBOSE_LOG (0)
+#define VWIRE_DEFAULT_RX_MODE     (VWIRE_RX_MODE_SAMPLE)
+#define VWIRE_DEFAULT_RX_QUEUE_LEN (8)
+#define VWIRE_DEFAULT_TX_QUEUE_LEN (4)
+#define VWIRE_DEFAULT_SAMPLES_PER_BIT (8)
+#define VWIRE_DEFAULT_DECODE_US   (2000)
+#define VWIRE_DEFAULT_FRAG        (0)
+#define VWIRE_DEFAULT_FRAG_TIMEOUT_MS (2000)
+#define VWIRE_DEFAULT_DEDUP_MS    (0)
+#define VWIRE_DEFAULT_NETDEV      (0)
+
+/* network interface: messages ndo_start_xmit() takes ahead of the 
+ * transmitter, the rest wait in the qdisc, and the qdisc length */
+#define VWIRE_NET_TX_BACKLOG      (4)
+#define VWIRE_NET_TX_QUEUE_LEN    (32)
+
+/* longest window for dropping retransmitted messages, in msec */
+#define VWIRE_DEDUP_MS_MAX        (60000)
+
+/* raw receiver capture, debugfs vwire/capture: words of 32 samples kept
+ * from before the trigger and taken after it, enough for the preamble and
+ * the longest message at 16 samples per bit, the ring the reader empties,
+ * and the most captures taken per second */
+#define VWIRE_CAPTURE_PRE_WORDS   (32)
+#define VWIRE_CAPTURE_POST_WORDS  (192)
+#define VWIRE_CAPTURE_RING_WORDS  (16384)
+#define VWIRE_CAPTURE_PER_SEC     (4)
+
+/* how the receiver pin is read */
+#define VWIRE_RX_MODE_SAMPLE      (0)  /* polled from the sample timer */
+#define VWIRE_RX_MODE_EDGE        (1)  /* both-edges interrupt, timestamped */
+#define VWIRE_RX_MODE_DEFERRED    (2)  /* sampled by the timer, decoded in a worker */
+
+/* deferred mode: limits of the decoder wakeup interval, in usec.  At the
+ * fastest sample rate the capture ring holds 20 msec */
+#define VWIRE_DECODE_US_MIN       (250)
+#define VWIRE_DECODE_US_MAX       (10000)
+
+/* edge mode: bit periods of silence after which the PLL is flushed */
+#define VWIRE_EDGE_FLUSH_BITS     (4)
+/* edge mode: most samples replayed for one gap when no message is active */
+#define VWIRE_EDGE_MAX_IDLE_BITS  (16)
 
 #define NSINSEC       (unsigned long)(1000000000)
 
 #define BAUD_MIN      (1000)  /* minimum allowed baudrate */
-#define BAUD_MAX      (5000)  /* maximum allowed baudrate */
+#define BAUD_MAX      (20000) /* maximum allowed baudrate, if the timer keeps up */
 
-#define VWIRE_MAX_MESSAGE_LEN     (20)
+/* shortest sample timer period we ask for, 100000 ticks/sec, whatever 
+ * the hrtimer resolution of the board would allow */
+#define VWIRE_MIN_TICK_NS  (10000)
 
 #define Limit(x, min, max)            ( (x<min)?(min):( (x>max)?(max):(x) ) )
 #define LimitErr(x, min, max, err)    ( (x<min)?(err):( (x>max)?(err):(x) ) )
-#define DelayFromBaudrate(baud)       (unsigned long)((NSINSEC/Limit(baud, BAUD_MIN, BAUD_MAX))/8)  /* bits/sec and 8 samples/bit */
+#define DelayFromBaudrate(baud, spb)  (unsigned long)((NSINSEC/Limit(baud, BAUD_MIN, BAUD_MAX))/(spb))  /* bits/sec and samples/bit */
 
 #endif
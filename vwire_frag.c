@@ -0,0 +1,190 @@
+// vwire_frag.c
+//
+// Optional fragmentation of messages longer than VW_MAX_PAYLOAD, see
+// vwire_frag.h for the format
+//
+// Nothing here is called at interrupt level: fragments are built by the
+// writer before vw_send() and reassembled by the reader after
+// vw_get_message(), so the receiver and transmitter are unchanged.
+// GPL2
+
+#include "vwire_port.h"
+
+#include "vwire_frag.h"
+#include "vwire_codec.h"
+
+// CRC of a whole message, as sent after one of more than one fragment
+static uint16_t vw_frag_crc(const uint8_t *msg, unsigned int len)
+{
+   uint16_t crc = 0xffff;
+
+   while (len-- > 0)
+      crc = vw_crc_update(crc, *msg++);
+   return crc;
+}
+
+uint8_t vw_frag_build(uint8_t id, const uint8_t *msg, unsigned int len,
+                      unsigned int index, uint8_t *frag)
+{
+   unsigned int total = vw_frag_count(len) > 1 ? len + VW_FRAG_CRC_LEN : len;
+   unsigned int offset = index * VW_FRAG_DATA_LEN;
+   unsigned int data_len = total - offset;
+   unsigned int i;
+   uint16_t crc;
+
+   if (data_len > VW_FRAG_DATA_LEN)
+      data_len = VW_FRAG_DATA_LEN;
+
+   frag[0] = id;
+   frag[1] = index;
+   if (offset + data_len >= total)
+      frag[1] |= VW_FRAG_LAST;
+
+   if (offset + data_len <= len)
+   {
+      memcpy(frag + VW_FRAG_HEADER_LEN, msg + offset, data_len);
+   }
+   else
+   {
+      // The CRC follows the message in the last fragment or two
+      crc = vw_frag_crc(msg, len);
+      for (i = 0; i < data_len; i++)
+         frag[VW_FRAG_HEADER_LEN + i] = offset + i < len 
+            ? msg[offset + i] : crc >> (8 * (offset + i - len));
+   }
+
+   return VW_FRAG_HEADER_LEN + data_len;
+}
+
+void vw_frag_rx_init(struct vw_frag_rx *rx, unsigned long timeout)
+{
+   rx->timeout = timeout;
+}
+
+// Give up on messages that took too long, their missing fragments were
+// lost on the air
+static void vw_frag_rx_expire(struct vw_frag_rx *rx)
+{
+   unsigned int i;
+
+   for (i = 0; i < VW_FRAG_SLOTS; i++)
+   {
+      if (rx->slot[i].busy && jiffies - rx->slot[i].started > rx->timeout)
+      {
+         rx->slot[i].busy = false;
+         rx->timed_out++;
+      }
+   }
+}
+
+// The slot collecting message id, or a new one for it. If all slots are
+// busy the message that started first makes room
+static struct vw_frag_slot *vw_frag_rx_slot(struct vw_frag_rx *rx, uint8_t id)
+{
+   struct vw_frag_slot *slot = NULL;
+   unsigned int i;
+
+   for (i = 0; i < VW_FRAG_SLOTS; i++)
+   {
+      if (rx->slot[i].busy && rx->slot[i].id == id)
+         return &rx->slot[i];
+   }
+
+   for (i = 0; i < VW_FRAG_SLOTS; i++)
+   {
+      if (!rx->slot[i].busy)
+      {
+         slot = &rx->slot[i];
+         break;
+      }
+      if (!slot || (int32_t)(rx->slot[i].age - slot->age) < 0)
+         slot = &rx->slot[i];
+   }
+   if (slot->busy)
+      rx->evicted++;
+
+   slot->busy = true;
+   slot->id = id;
+   slot->have = 0;
+   slot->have_last = false;
+   slot->started = jiffies;
+   slot->age = rx->age++;
+   return slot;
+}
+
+const uint8_t *vw_frag_rx_put(struct vw_frag_rx *rx, const uint8_t *frag,
+                              uint8_t len, unsigned int *msg_len)
+{
+   struct vw_frag_slot *slot;
+   uint8_t index, last;
+   unsigned int data_len;
+   uint16_t crc;
+
+   if (len < VW_FRAG_HEADER_LEN)
+   {
+      rx->invalid++;
+      return NULL;
+   }
+
+   index = frag[1] & VW_FRAG_INDEX_MASK;
+   last = frag[1] & VW_FRAG_LAST;
+   data_len = len - VW_FRAG_HEADER_LEN;
+
+   // Only the last fragment may be short
+   if ((frag[1] & ~(VW_FRAG_INDEX_MASK | VW_FRAG_LAST))
+         || (!last && data_len != VW_FRAG_DATA_LEN))
+   {
+      rx->invalid++;
+      return NULL;
+   }
+
+   vw_frag_rx_expire(rx);
+
+   // A message that fits in one fragment needs no slot
+   if (last && index == 0)
+   {
+      rx->complete++;
+      *msg_len = data_len;
+      return frag + VW_FRAG_HEADER_LEN;
+   }
+
+   slot = vw_frag_rx_slot(rx, frag[0]);
+   if (last)
+   {
+      slot->last = index;
+      slot->have_last = true;
+      slot->len = index * VW_FRAG_DATA_LEN + data_len;
+   }
+   else if (slot->have_last && index > slot->last)
+   {
+      rx->invalid++;
+      return NULL;
+   }
+
+   memcpy(slot->buf + index * VW_FRAG_DATA_LEN, frag + VW_FRAG_HEADER_LEN, data_len);
+   slot->have |= 1ULL << index;
+
+   // Complete once every fragment up to the last one is in
+   if (!slot->have_last || slot->have != (~0ULL >> (63 - slot->last)))
+      return NULL;
+
+   slot->busy = false;
+
+   // Too short to have needed more than one fragment, or fragments of
+   // another message with the same id spoiled the CRC
+   *msg_len = slot->len - VW_FRAG_CRC_LEN;
+   if (*msg_len <= VW_FRAG_DATA_LEN)
+   {
+      rx->invalid++;
+      return NULL;
+   }
+   crc = vw_frag_crc(slot->buf, *msg_len);
+   if (slot->buf[*msg_len] != (uint8_t)crc || slot->buf[*msg_len + 1] != crc >> 8)
+   {
+      rx->invalid++;
+      return NULL;
+   }
+
+   rx->complete++;
+   return slot->buf;
+}
@@ -0,0 +1,127 @@
+// vwire_frag.h
+//
+// Optional fragmentation of messages longer than VW_MAX_PAYLOAD
+//
+// A message is sent as up to VW_FRAG_MAX_COUNT Virtual Wire messages, each
+// starting with a 2 byte header: the message id, the same in all fragments
+// of one message, then the fragment index with VW_FRAG_LAST set on the
+// last one. All but the last fragment carry exactly VW_FRAG_DATA_LEN bytes.
+// A message that takes more than one fragment is followed by a CRC of the
+// whole of it, so fragments of two messages that got the same id, for
+// example from two senders, are not spliced into one unnoticed.
+// The receiver collects at most VW_FRAG_SLOTS messages at a time and drops
+// one that is not complete within its timeout, so its memory is bounded by
+// sizeof(struct vw_frag_rx).
+// Both ends of a link have to agree on using it.
+// GPL2
+
+#ifndef vwire_frag_h
+#define vwire_frag_h
+
+#include "vwire.h"
+
+/// Bytes of header in front of each fragment
+#define VW_FRAG_HEADER_LEN 2
+
+/// Message bytes carried by each fragment but the last
+#define VW_FRAG_DATA_LEN ((VW_MAX_PAYLOAD) - VW_FRAG_HEADER_LEN)
+
+/// Most fragments of one message, the index has 6 bits
+#define VW_FRAG_MAX_COUNT 64
+
+/// Bytes of CRC-CCITT, low byte first, after a message of more than one
+/// fragment
+#define VW_FRAG_CRC_LEN 2
+
+/// Longest message that can be sent in fragments
+#define VW_FRAG_MAX_LEN (VW_FRAG_MAX_COUNT * VW_FRAG_DATA_LEN - VW_FRAG_CRC_LEN)
+
+/// Set in the index byte of the last fragment of a message
+#define VW_FRAG_LAST 0x80
+
+/// Fragment index in the index byte
+#define VW_FRAG_INDEX_MASK 0x3f
+
+/// Messages that can be reassembled at the same time
+#define VW_FRAG_SLOTS 4
+
+/// One message being reassembled
+struct vw_frag_slot
+{
+   /// Set while fragments of this message are being collected
+   uint8_t busy;
+
+   /// Message id from the fragment header
+   uint8_t id;
+
+   /// Index of the last fragment, once it has arrived
+   uint8_t last;
+   uint8_t have_last;
+
+   /// Bit n is set once fragment n has arrived
+   uint64_t have;
+
+   /// jiffies when the first fragment arrived
+   unsigned long started;
+
+   /// Order in which the slots were taken, the lowest is evicted first
+   uint32_t age;
+
+   /// Length of the message and its CRC, known once the last fragment has
+   /// arrived
+   uint16_t len;
+
+   uint8_t buf[VW_FRAG_MAX_COUNT * VW_FRAG_DATA_LEN];
+};
+
+/// Reassembly state of one receiver
+struct vw_frag_rx
+{
+   struct vw_frag_slot slot[VW_FRAG_SLOTS];
+
+   /// jiffies a message may take from its first to its last fragment
+   unsigned long timeout;
+
+   /// Slots taken so far
+   uint32_t age;
+
+   /// Messages completed, dropped for taking longer than timeout, dropped
+   /// to make room for a newer one, and fragments with a bad header or
+   /// messages with a bad CRC
+   uint32_t complete;
+   uint32_t timed_out;
+   uint32_t evicted;
+   uint32_t invalid;
+};
+
+/// Number of fragments a message of len bytes is sent in, at least 1
+static inline unsigned int vw_frag_count(unsigned int len)
+{
+   if (len <= VW_FRAG_DATA_LEN)
+      return 1;
+   return (len + VW_FRAG_CRC_LEN + VW_FRAG_DATA_LEN - 1) / VW_FRAG_DATA_LEN;
+}
+
+/// Build fragment index of a message
+/// \param[in] id Message id, the same for all fragments of the message
+/// \param[in] msg The whole message, at most VW_FRAG_MAX_LEN bytes
+/// \param[in] len Length of the message
+/// \param[in] index Fragment to build, below vw_frag_count(len)
+/// \param[out] frag At least VW_MAX_PAYLOAD bytes
+/// \return Length of the fragment, to pass to vw_send()
+extern uint8_t vw_frag_build(uint8_t id, const uint8_t *msg, unsigned int len,
+                             unsigned int index, uint8_t *frag);
+
+/// Initialise a zeroed reassembly state
+/// \param[in] timeout jiffies allowed from the first to the last fragment
+extern void vw_frag_rx_init(struct vw_frag_rx *rx, unsigned long timeout);
+
+/// Hand one received fragment to the reassembly, in the order received
+/// \param[in] frag The fragment, as returned by vw_get_message()
+/// \param[in] len Its length
+/// \param[out] msg_len Length of the completed message
+/// \return The completed message, valid until the next call, or NULL
+extern const uint8_t *vw_frag_rx_put(struct vw_frag_rx *rx, const uint8_t *frag,
+                                     uint8_t len, unsigned int *msg_len);
+
+#endif
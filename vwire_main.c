@@ -18,6 +18,7 @@
  *
  */
 
+#include <linux/version.h>
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/kernel.h>
@@ -26,93 +27,885 @@
 #include <linux/gpio.h>
 #include <linux/device.h>
 #include <linux/err.h>
+#include <linux/interrupt.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/rwsem.h>
+#include <linux/miscdevice.h>
+#include <linux/fs.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/netdevice.h>
+#include <linux/skbuff.h>
+#include <linux/if_arp.h>
+#include <linux/if_ether.h>
+#include <linux/string.h>
+#include <linux/workqueue.h>
+#include <linux/uaccess.h>
+#include <linux/debugfs.h>
 
 #include "vwire_config.h"
 #include "vwire.h"
+#include "vwire_codec.h"
+#include "vwire_frag.h"
+#include "vwire_uapi.h"
+#include "vwire_timing.h"
+#include "vwire_capture.h"
+
+#define CREATE_TRACE_POINTS
+#include "vwire_trace.h"
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("William Skellenger (wskellenger@gmail.com)");
 MODULE_DESCRIPTION("VirtualWire driver, intended for Raspberry Pi");
 
 static struct class     *device_class;
-static struct device    *device_object;
+static struct dentry    *vwire_debugfs_dir;   /* /sys/kernel/debug/vwire */
 
 
-static struct hrtimer   vwire_sample_timer;  /* high res timer to sample gpio */
+static struct hrtimer   vwire_sample_timer;  /* high res timer to sample gpio, shared by all channels */
 
 static unsigned short   vwire_baudrate = VWIRE_DEFAULT_BAUD_RATE;  /* speed in bits per sec */
 module_param(vwire_baudrate, ushort, 0000);
 MODULE_PARM_DESC(vwire_baudrate, 
       "The transmission speed in bits/sec, default 2000.");
 
-static unsigned char    vwire_tx_gpio = VWIRE_DEFAULT_TX_GPIO;
-module_param(vwire_tx_gpio, byte, 0000);
+/* Pins are given per channel, e.g. vwire_rx_gpio=13,19 vwire_tx_gpio=16,0 
+ * for two receivers and one transmitter.  The longest of the rx and tx lists
+ * sets the number of channels. */
+static unsigned char    vwire_tx_gpio[VWIRE_MAX_CHANNELS] = { VWIRE_DEFAULT_TX_GPIO };
+static int              vwire_tx_gpio_num;
+module_param_array(vwire_tx_gpio, byte, &vwire_tx_gpio_num, 0000);
 MODULE_PARM_DESC(vwire_tx_gpio, 
-      "The GPIO pin to use for the transmitter, 0=disabled.");
+      "The GPIO pin to use for the transmitter of each channel, 0=disabled.");
 
-static unsigned char    vwire_rx_gpio = VWIRE_DEFAULT_RX_GPIO;
-module_param(vwire_rx_gpio, byte, 0000);
+static unsigned char    vwire_rx_gpio[VWIRE_MAX_CHANNELS] = { VWIRE_DEFAULT_RX_GPIO };
+static int              vwire_rx_gpio_num;
+module_param_array(vwire_rx_gpio, byte, &vwire_rx_gpio_num, 0000);
 MODULE_PARM_DESC(vwire_rx_gpio, 
-      "The GPIO pin to use for the receiver, 0=disabled.");
+      "The GPIO pin to use for the receiver of each channel, 0=disabled.");
 
-static unsigned char    vwire_ptt_gpio = VWIRE_DEFAULT_PTT_GPIO;
-module_param(vwire_ptt_gpio, byte, 0000);
+static unsigned char    vwire_ptt_gpio[VWIRE_MAX_CHANNELS] = { VWIRE_DEFAULT_PTT_GPIO };
+module_param_array(vwire_ptt_gpio, byte, NULL, 0000);
 MODULE_PARM_DESC(vwire_ptt_gpio, 
-      "The GPIO pin to use for PTT (push-to-transmit), 0=disabled.");
+      "The GPIO pin to use for PTT (push-to-transmit) of each channel, 0=disabled.");
 
-static unsigned char    vwire_led_gpio = VWIRE_DEFAULT_LED_GPIO;
-module_param(vwire_led_gpio, byte, 0000);
+static unsigned char    vwire_led_gpio[VWIRE_MAX_CHANNELS] = { VWIRE_DEFAULT_LED_GPIO };
+module_param_array(vwire_led_gpio, byte, NULL, 0000);
 MODULE_PARM_DESC(vwire_led_gpio, 
-      "The GPIO pin to use to drive a status LED, 0=disabled.");
+      "The GPIO pin to use to drive a status LED of each channel, 0=disabled.");
 
-static unsigned char    vwire_ptt_invert = VWIRE_DEFAULT_PTT_INVERT;
-module_param(vwire_ptt_invert, byte, 0000);
+static unsigned char    vwire_ptt_invert[VWIRE_MAX_CHANNELS] = { VWIRE_DEFAULT_PTT_INVERT };
+module_param_array(vwire_ptt_invert, byte, NULL, 0000);
 MODULE_PARM_DESC(vwire_ptt_invert, 
-      "Invert the PTT signal.");
+      "Invert the PTT signal of each channel.");
+
+static unsigned char    vwire_samples_per_bit[VWIRE_MAX_CHANNELS] = {
+   [0 ... VWIRE_MAX_CHANNELS - 1] = VWIRE_DEFAULT_SAMPLES_PER_BIT
+};
+module_param_array(vwire_samples_per_bit, byte, NULL, 0000);
+MODULE_PARM_DESC(vwire_samples_per_bit, 
+      "Samples taken of each bit on each channel: 4 (clean links only), 8 or 16, default 8.");
+
+/* e.g. vwire_baudrate=4000 vwire_rx_rates=1000,2000 to hear nodes at all
+ * three rates, each has to divide the samples a receiver takes evenly */
+static unsigned short   vwire_rx_rates[VW_RX_RATES_MAX];
+static int              vwire_rx_rates_num;
+module_param_array(vwire_rx_rates, ushort, &vwire_rx_rates_num, 0000);
+MODULE_PARM_DESC(vwire_rx_rates, 
+      "Other baud rates every receiver decodes from the same samples, up to 3, default none.");
+
+static unsigned char    vwire_rx_mode = VWIRE_DEFAULT_RX_MODE;
+module_param(vwire_rx_mode, byte, 0000);
+MODULE_PARM_DESC(vwire_rx_mode, 
+      "How the receivers are read: 0=sampled by the timer, 1=both-edges interrupt, "
+      "2=sampled by the timer and decoded in a worker.");
+
+static unsigned int     vwire_decode_us = VWIRE_DEFAULT_DECODE_US;
+module_param(vwire_decode_us, uint, 0000);
+MODULE_PARM_DESC(vwire_decode_us, 
+      "With vwire_rx_mode=2, usec of samples collected before the decoder runs, 250 to 10000, default 2000.");
+
+static unsigned int     vwire_rx_queue_len = VWIRE_DEFAULT_RX_QUEUE_LEN;
+module_param(vwire_rx_queue_len, uint, 0000);
+MODULE_PARM_DESC(vwire_rx_queue_len, 
+      "Number of received messages kept until read, power of 2 up to 64, default 8.");
+
+static unsigned int     vwire_tx_queue_len = VWIRE_DEFAULT_TX_QUEUE_LEN;
+module_param(vwire_tx_queue_len, uint, 0000);
+MODULE_PARM_DESC(vwire_tx_queue_len, 
+      "Number of messages that can wait to be sent, power of 2 up to 16, default 4.");
+
+static unsigned char    vwire_frag = VWIRE_DEFAULT_FRAG;
+module_param(vwire_frag, byte, 0000);
+MODULE_PARM_DESC(vwire_frag, 
+      "1 to send and receive messages of up to 1598 bytes in fragments, default 0.");
+
+static unsigned int     vwire_frag_timeout_ms = VWIRE_DEFAULT_FRAG_TIMEOUT_MS;
+module_param(vwire_frag_timeout_ms, uint, 0000);
+MODULE_PARM_DESC(vwire_frag_timeout_ms, 
+      "Time a fragmented message may take to arrive, in msec, default 2000.");
+
+static unsigned int     vwire_dedup_ms = VWIRE_DEFAULT_DEDUP_MS;
+module_param(vwire_dedup_ms, uint, 0000);
+MODULE_PARM_DESC(vwire_dedup_ms, 
+      "Drop copies of a message received again within this many msec, up to 60000, default 0 (off).");
+
+static unsigned char    vwire_netdev = VWIRE_DEFAULT_NETDEV;
+module_param(vwire_netdev, byte, 0000);
+MODULE_PARM_DESC(vwire_netdev, 
+      "1 to make every channel a network interface too, named like its /dev node, default 0.");
 
 static unsigned char    vwire_verbose = VWIRE_DEFAULT_VERBOSE_LOG;
 
+/* Baud rate and pins can be changed through sysfs while running.  One
+ * change at a time, and vwire_cfg_sem keeps senders from restarting the
+ * sample timer while it is stopped for the change. */
+static DEFINE_MUTEX(vwire_cfg_lock);
+static DECLARE_RWSEM(vwire_cfg_sem);
+
+struct vwire_chan;
+
+/* One consumer of the received messages: every open /dev file has one,
+ * and each channel one for its receive attribute.  Each keeps its own 
+ * place in the receive queue, so no reader takes a message from another
+ * and a slow one only loses its own backlog. */
+struct vwire_reader {
+   struct vwire_chan    *chan;
+   struct mutex         lock;          /* one read at a time */
+   struct vw_rx_cursor  *cursor;       /* file_cursor, or the channel's own */
+   struct vw_rx_cursor  file_cursor;
+   struct vw_frag_rx    *frag_rx;      /* reassembly, with vwire_frag */
+   unsigned int         format;        /* VWIRE_RX_FORMAT_* of read() */
+   struct vw_rx_meta    meta;          /* of the last message from vwire_recv() */
+   unsigned char        frame[VW_MAX_PAYLOAD];
+};
+
+/* The channel as a network interface, with vwire_netdev.  Received 
+ * messages go up from the NAPI poll, sent ones are handed from 
+ * ndo_start_xmit() to tx_work, which may sleep in vwire_send(). */
+struct vwire_net {
+   struct vwire_chan    *chan;
+   struct net_device    *dev;
+   struct napi_struct   napi;
+   struct vwire_reader  reader;     /* only used by the NAPI poll, no lock */
+   struct sk_buff_head  txq;
+   struct work_struct   tx_work;
+
+   /* rtnl_link_stats64, rx written by the NAPI poll and tx by tx_work */
+   struct u64_stats_sync rx_syncp;
+   struct u64_stats_sync tx_syncp;
+   u64                  rx_packets;
+   u64                  rx_bytes;
+   u64                  rx_crc_errors;
+   u64                  rx_dropped;
+   u64                  tx_packets;
+   u64                  tx_bytes;
+   u64                  tx_errors;
+   atomic_long_t        tx_dropped;  /* from ndo_start_xmit() */
+};
+
+/* One radio channel: the protocol state and what the kernel side needs 
+ * to expose it as /sys/class/vwire/<name> and /dev/<name> */
+struct vwire_chan {
+   struct vw_channel    vw;
+   char                 name[16];
+
+   struct device        *dev;
+   struct miscdevice    misc;
+
+   struct vwire_reader  reader;     /* of the receive attribute, vw_get_message() */
+   struct vw_rx_ring    *rx_ring;   /* the receive queue, mapped by vwire_dev_mmap() */
+   struct mutex         tx_lock;    /* vw_send() takes one writer at a time */
+   struct mutex         stats_lock; /* serializes vw_reset_stats() */
+
+   /* with vwire_frag, the id of the next message sent, under tx_lock */
+   unsigned char        frag_tx_id;
+
+   /* with vwire_netdev */
+   struct vwire_net     *net;
+
+   /* woken from interrupt level by the protocol callbacks */
+   wait_queue_head_t    rx_wait;
+   wait_queue_head_t    tx_wait;
+
+   /* edge mode state, the sample timer then only runs while transmitting */
+   int                  rx_irq;
+   struct hrtimer       edge_flush_timer;  /* flushes the PLL after the last edge */
+   spinlock_t           edge_lock;
+   ktime_t              edge_sample_time;  /* time of the last sample fed to the PLL */
+   unsigned char        edge_level;        /* rx level since the last edge */
+
+   /* deferred mode: runs the PLL over the samples the timer captured */
+   struct work_struct   decode_work;
+
+   /* the sample timer ticks for the channel sampling fastest, the others 
+    * run their protocol handler on every tick_div'th tick only */
+   unsigned int         tick_div;
+   unsigned int         tick_count;
+};
+
+static struct vwire_chan vwire_chans[VWIRE_MAX_CHANNELS];
+static unsigned int      vwire_num_chans;
+static unsigned int      vwire_tick_spb;   /* samples per bit of the sample timer */
+
+/* nanoseconds between two samples of a channel, or of the sample timer */
+static unsigned long vwire_sample_ns(unsigned int spb)
+{
+   return DelayFromBaudrate(vwire_baudrate, spb);
+}
+
+/* Can the sample timer run fast enough for this baud rate with a channel
+ * taking spb samples per bit? */
+static int vwire_check_rate(unsigned int baud, unsigned int spb)
+{
+   unsigned long tick_ns;
+
+   if (baud < BAUD_MIN || baud > BAUD_MAX)
+      return -EINVAL;
+
+   tick_ns = DelayFromBaudrate(baud, spb);
+   if (tick_ns < VWIRE_MIN_TICK_NS || tick_ns < hrtimer_resolution) {
+      printk(KERN_ERR VWIRE_DRV_NAME ": %u baud at %u samples per bit needs a %lu ns timer, too fast\n",
+            baud, spb, tick_ns);
+      return -ERANGE;
+   }
+   return 0;
+}
+
+/* The sample timer runs at the highest oversampling of any channel.  
+ * Only while the timer is stopped. */
+static void vwire_update_ticks(void)
+{
+   unsigned int i;
+
+   vwire_tick_spb = VW_RX_SAMPLES_PER_BIT_MIN;
+   for (i = 0; i < vwire_num_chans; i++)
+      vwire_tick_spb = max_t(unsigned int, vwire_tick_spb, vwire_chans[i].vw.samples_per_bit);
+
+   for (i = 0; i < vwire_num_chans; i++) {
+      vwire_chans[i].tick_div = vwire_tick_spb / vwire_chans[i].vw.samples_per_bit;
+      vwire_chans[i].tick_count = 0;
+   }
+}
+
+/* is any channel sending or holding a message to send */
+static bool vwire_tx_busy(void)
+{
+   unsigned int i;
+
+   for (i = 0; i < vwire_num_chans; i++) {
+      if (vx_tx_active(&vwire_chans[i].vw) || vw_tx_queue_count(&vwire_chans[i].vw))
+         return true;
+   }
+   return false;
+}
+
 /* High speed loop */
-/* The high speed loop samples the rx pin and sets thx tx pin.
- * --> 8 samples for each bit 
+/* The high speed loop samples the rx pins and sets thx tx pins of every
+ * channel.
+ * --> 8 samples for each bit (default, 4 to 16 per channel)
  * --> 2000 bits/sec (default)
  * --> 16,000 samples/sec
  */
 enum hrtimer_restart vwire_sample_timer_callback(struct hrtimer *timer) 
 {
-   ktime_t ktime;
+   ktime_t ktime, start = 0, late = 0;
+   unsigned int i;
+   u64 overruns;
 
    /* This is a high speed sampling, at 2000 baud this loop will run 
     * every 62.5 us.  Higher speeds generally mean poorer reception,
     * and I'm not sure how fast we can push this... --wjs */
 
-   /* schedule the next timer hit now */
-   ktime = ktime_set(0, DelayFromBaudrate(vwire_baudrate));
-   hrtimer_forward_now(timer, ktime);
+   if (static_branch_unlikely(&vwire_timing_enabled)) {
+      start = ktime_get();
+      late = ktime_sub(start, hrtimer_get_expires(timer));
+   }
+
+   /* schedule the next timer hit now, more than one period forward means
+    * we were so late that samples were lost */
+   ktime = ktime_set(0, vwire_sample_ns(vwire_tick_spb));
+   overruns = hrtimer_forward_now(timer, ktime);
+   if (unlikely(overruns > 1))
+      vwire_timing_missed(overruns - 1);
 
    /* Mike McCauley's VirtualWire ported from Arduino */
-   vw_int_handler();
+   for (i = 0; i < vwire_num_chans; i++) {
+      struct vwire_chan *chan = &vwire_chans[i];
+
+      if (++chan->tick_count >= chan->tick_div) {
+         chan->tick_count = 0;
+         vw_int_handler(&chan->vw);
+      }
+   }
+
+   if (static_branch_unlikely(&vwire_timing_enabled))
+      vwire_timing_record(late, ktime_sub(ktime_get(), start));
+
+   /* in edge mode the timer is only needed to clock out messages, 
+    * vwire_kick_sample_timer() restarts it when a new one is queued */
+   if (vwire_rx_mode == VWIRE_RX_MODE_EDGE) {
+      smp_mb();  /* pairs with vwire_kick_sample_timer() */
+      if (!vwire_tx_busy())
+         return HRTIMER_NORESTART;
+   }
 
    /* restart the timer */
    return HRTIMER_RESTART;
 }
 
+/* Edge mode */
+/* Replay the samples the timer would have taken between the last sample 
+ * fed to the PLL and now.  The rx pin held chan->edge_level all that time.
+ * Must be called with chan->edge_lock held. */
+static void vwire_edge_catch_up(struct vwire_chan *chan, ktime_t now)
+{
+   unsigned long period = vwire_sample_ns(chan->vw.samples_per_bit);
+   s64 elapsed = ktime_to_ns(ktime_sub(now, chan->edge_sample_time));
+   u64 samples;
+
+   if (elapsed < (s64)period)
+      return;
+
+   samples = div_u64(elapsed, period);
+   chan->edge_sample_time = ktime_add_ns(chan->edge_sample_time, samples * period);
+
+   /* after a long silence the PLL only needs enough samples to shift 
+    * out the old bits, unless a message is still being received */
+   if (!vw_rx_in_progress(&chan->vw))
+      samples = min_t(u64, samples, VWIRE_EDGE_MAX_IDLE_BITS * chan->vw.samples_per_bit);
+
+   vw_rx_feed(&chan->vw, chan->edge_level, samples);
+}
+
+static void vwire_edge_arm_flush(struct vwire_chan *chan)
+{
+   ktime_t ktime;
+
+   /* the last bits of a message may not end with an edge */
+   if (vw_rx_in_progress(&chan->vw)) {
+      ktime = ktime_set(0, VWIRE_EDGE_FLUSH_BITS * NSINSEC / vwire_baudrate);
+      hrtimer_start(&chan->edge_flush_timer, ktime, HRTIMER_MODE_REL);
+   }
+}
+
+static irqreturn_t vwire_rx_edge_handler(int irq, void *dev_id)
+{
+   struct vwire_chan *chan = dev_id;
+   ktime_t now = ktime_get();
+   unsigned long flags;
+
+   spin_lock_irqsave(&chan->edge_lock, flags);
+
+   vwire_edge_catch_up(chan, now);
+   chan->edge_level = gpio_get_value(chan->vw.receiver.gpio);
+   vwire_edge_arm_flush(chan);
+
+   spin_unlock_irqrestore(&chan->edge_lock, flags);
+
+   return IRQ_HANDLED;
+}
+
+enum hrtimer_restart vwire_edge_flush_callback(struct hrtimer *timer)
+{
+   struct vwire_chan *chan = container_of(timer, struct vwire_chan, edge_flush_timer);
+   unsigned long flags;
+
+   spin_lock_irqsave(&chan->edge_lock, flags);
+
+   vwire_edge_catch_up(chan, ktime_get());
+   vwire_edge_arm_flush(chan);
+
+   spin_unlock_irqrestore(&chan->edge_lock, flags);
+
+   return HRTIMER_NORESTART;
+}
+
+static int vwire_edge_init(struct vwire_chan *chan)
+{
+   int irq, err;
+
+   /* a channel without a receiver has no edges to catch */
+   if (chan->vw.receiver.label == NULL)
+      return 0;
+
+   chan->edge_sample_time = ktime_get();
+   chan->edge_level = gpio_get_value(chan->vw.receiver.gpio);
+
+   irq = gpio_to_irq(chan->vw.receiver.gpio);
+   if (irq < 0)
+      return irq;
+
+   err = request_irq(irq, vwire_rx_edge_handler,
+         IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING, chan->name, chan);
+   if (err)
+      return err;
+
+   chan->rx_irq = irq;
+   printk(KERN_INFO VWIRE_DRV_NAME ": Requested IRQ %d for %s RX edges\n", chan->rx_irq, chan->name);
+   return 0;
+}
+
+static void vwire_edge_cleanup(struct vwire_chan *chan)
+{
+   if (chan->rx_irq >= 0) {
+      free_irq(chan->rx_irq, chan);
+      chan->rx_irq = -1;
+   }
+   hrtimer_cancel(&chan->edge_flush_timer);
+}
+
+/* The sample timer has to be running to transmit.  In edge mode it stops 
+ * itself once no channel has anything to send, so restart it for a new 
+ * message. */
+static void vwire_kick_sample_timer(void)
+{
+   ktime_t ktime;
+
+   if (vwire_rx_mode != VWIRE_RX_MODE_EDGE)
+      return;
+
+   /* the message is queued before we look at the timer, and the timer 
+    * callback looks at the queue after it stopped being queued.  A 
+    * callback still running counts as active: it sees the message and 
+    * restarts itself, and starting the timer under it would make its 
+    * hrtimer_forward_now() warn */
+   smp_mb();
+   if (!hrtimer_active(&vwire_sample_timer)) {
+      ktime = ktime_set(0, vwire_sample_ns(vwire_tick_spb));
+      hrtimer_start(&vwire_sample_timer, ktime, HRTIMER_MODE_REL);
+   }
+}
+
+/* --- deferred decoding */
+/* In deferred mode the sample timer only packs the receiver samples into 
+ * words, the PLL and everything after it runs from this work item, on 
+ * whatever CPU the unbound workqueue picks. */
+static void vwire_decode_work(struct work_struct *work)
+{
+   struct vwire_chan *chan = container_of(work, struct vwire_chan, decode_work);
+
+   /* the receive counters are u64_stats, their writer must not be 
+    * preempted by a reader on 32 bit machines */
+   local_bh_disable();
+   vw_rx_decode(&chan->vw);
+   local_bh_enable();
+}
+
+/* called from the sample timer when a batch of samples is waiting */
+static void vwire_capture_ready(struct vw_channel *ch)
+{
+   struct vwire_chan *chan = ch->priv;
+
+   queue_work(system_unbound_wq, &chan->decode_work);
+}
+
+/* Words of 32 samples that make up vwire_decode_us at the current rate */
+static void vwire_decode_setup(struct vwire_chan *chan)
+{
+   unsigned long words_per_sec = vwire_baudrate * chan->vw.samples_per_bit / 32;
+
+   if (vwire_rx_mode != VWIRE_RX_MODE_DEFERRED)
+      return;
+
+   vw_set_rx_deferred(&chan->vw, 
+         max(words_per_sec * vwire_decode_us / USEC_PER_SEC, 1UL),
+         vwire_capture_ready);
+}
+
+/* Fit the decoders for vwire_rx_rates into the samples the channel takes,
+ * each at the most samples per bit that divides them evenly and taking 
+ * every step'th of them.  One that does not fit is switched off.
+ * Only while the receiver is stopped. */
+static void vwire_rates_setup(struct vwire_chan *chan)
+{
+   unsigned int samples = vwire_baudrate * chan->vw.samples_per_bit;
+   struct vw_channel *rate;
+   unsigned int i, baud, spb;
+
+   for (i = 0; i < chan->vw.rx_rates; i++) {
+      rate = chan->vw.rx_rate[i];
+      baud = vwire_rx_rates[i];
+      spb = 0;
+
+      if (baud >= BAUD_MIN && baud <= BAUD_MAX && baud != vwire_baudrate) {
+         for (spb = VW_RX_SAMPLES_PER_BIT_MAX; spb >= VW_RX_SAMPLES_PER_BIT_MIN; spb /= 2)
+            if (samples % (baud * spb) == 0)
+               break;
+      }
+      if (spb < VW_RX_SAMPLES_PER_BIT_MIN) {
+         printk(KERN_INFO VWIRE_DRV_NAME 
+               ": %s: not decoding %u baud, it does not go into %u samples/sec at 4, 8 or 16 a bit\n",
+               chan->name, baud, samples);
+         vw_set_rx_step(rate, 0);
+         continue;
+      }
+
+      vw_set_samples_per_bit(rate, spb);
+      vw_set_tx_bit_time(rate, NSINSEC / baud);
+      vw_set_rx_step(rate, samples / (baud * spb));
+   }
+}
+
+/* --- runtime reconfiguration */
+/* Stop everything that runs by itself: the sample timer and, in edge mode,
+ * the receiver interrupts.  A message being received is lost, a message 
+ * being sent is sent again from the start after vwire_resume().
+ * Called with vwire_cfg_lock and vwire_cfg_sem held. */
+static void vwire_quiesce(void)
+{
+   struct vwire_chan *chan;
+   unsigned int i;
+
+   hrtimer_cancel(&vwire_sample_timer);
+
+   for (i = 0; i < vwire_num_chans; i++) {
+      chan = &vwire_chans[i];
+      if (chan->rx_irq >= 0)
+         disable_irq(chan->rx_irq);
+      hrtimer_cancel(&chan->edge_flush_timer);
+      cancel_work_sync(&chan->decode_work);
+
+      vw_rx_stop(&chan->vw);
+      vw_tx_rewind(&chan->vw);
+   }
+}
+
+static void vwire_resume(void)
+{
+   struct vwire_chan *chan;
+   ktime_t ktime;
+   unsigned int i;
+
+   vwire_update_ticks();
+   for (i = 0; i < vwire_num_chans; i++) {
+      chan = &vwire_chans[i];
+      vw_set_tx_bit_time(&chan->vw, NSINSEC / vwire_baudrate);
+      vwire_decode_setup(chan);
+      vwire_rates_setup(chan);
+      if (chan->vw.receiver.label)
+         vw_rx_start(&chan->vw);
+      if (chan->rx_irq >= 0) {
+         chan->edge_sample_time = ktime_get();
+         chan->edge_level = gpio_get_value(chan->vw.receiver.gpio);
+         enable_irq(chan->rx_irq);
+      }
+   }
+
+   if (vwire_rx_mode != VWIRE_RX_MODE_EDGE || vwire_tx_busy()) {
+      ktime = ktime_set(0, vwire_sample_ns(vwire_tick_spb));
+      hrtimer_start(&vwire_sample_timer, ktime, HRTIMER_MODE_REL);
+   }
+}
+
+static int vwire_set_baudrate(unsigned int baud)
+{
+   int err;
+
+   mutex_lock(&vwire_cfg_lock);
+
+   err = vwire_check_rate(baud, vwire_tick_spb);
+   if (err) {
+      mutex_unlock(&vwire_cfg_lock);
+      return err;
+   }
+
+   down_write(&vwire_cfg_sem);
+
+   vwire_quiesce();
+   vwire_baudrate = baud;
+   vwire_resume();
+
+   up_write(&vwire_cfg_sem);
+   mutex_unlock(&vwire_cfg_lock);
+
+   printk(KERN_INFO VWIRE_DRV_NAME ": baudrate %u\n", baud);
+   return 0;
+}
+
+/* Change the oversampling of one channel, which may change the rate of 
+ * the sample timer for all of them. */
+static int vwire_set_samples_per_bit(struct vwire_chan *chan, unsigned int spb)
+{
+   int err;
+
+   if (spb != VW_RX_SAMPLES_PER_BIT_MIN && spb != VW_RX_SAMPLES_PER_BIT
+         && spb != VW_RX_SAMPLES_PER_BIT_MAX)
+      return -EINVAL;
+
+   mutex_lock(&vwire_cfg_lock);
+
+   err = vwire_check_rate(vwire_baudrate, spb);
+   if (err) {
+      mutex_unlock(&vwire_cfg_lock);
+      return err;
+   }
+
+   down_write(&vwire_cfg_sem);
+
+   vwire_quiesce();
+   vw_set_samples_per_bit(&chan->vw, spb);
+   vwire_resume();
+
+   up_write(&vwire_cfg_sem);
+   mutex_unlock(&vwire_cfg_lock);
+
+   printk(KERN_INFO VWIRE_DRV_NAME ": %s: %u samples per bit\n", chan->name, spb);
+   return 0;
+}
+
+/* the pins of a channel, as they can be changed from sysfs */
+enum vwire_pin {
+   VWIRE_PIN_TX,
+   VWIRE_PIN_RX,
+   VWIRE_PIN_PTT,
+   VWIRE_PIN_LED,
+   VWIRE_PIN_PTT_INVERT,
+};
+
+static void vwire_apply_pins(struct vw_channel *ch, const unsigned char *pins)
+{
+   vw_set_tx_pin(ch, pins[VWIRE_PIN_TX]);
+   vw_set_rx_pin(ch, pins[VWIRE_PIN_RX]);
+   vw_set_ptt_pin(ch, pins[VWIRE_PIN_PTT]);
+   vw_set_led_pin(ch, pins[VWIRE_PIN_LED]);
+   vw_set_ptt_inverted(ch, pins[VWIRE_PIN_PTT_INVERT]);
+}
+
+/* Take the GPIOs of pins and, in edge mode, the receiver interrupt, which
+ * stays masked until vwire_resume() like the others */
+static int vwire_setup_pins(struct vwire_chan *chan, const unsigned char *pins)
+{
+   int err;
+
+   vwire_apply_pins(&chan->vw, pins);
+   err = vw_setup(&chan->vw);
+   if (err || vwire_rx_mode != VWIRE_RX_MODE_EDGE)
+      return err;
+
+   err = vwire_edge_init(chan);
+   if (err == 0 && chan->rx_irq >= 0)
+      disable_irq(chan->rx_irq);
+   return err;
+}
+
+/* Change one pin of a channel.  All of its GPIOs are given back and 
+ * requested again by vw_setup(), if the new set or its edge interrupt can
+ * not be had the old one is put back. */
+static int vwire_set_pin(struct vwire_chan *chan, enum vwire_pin which, unsigned char value)
+{
+   struct vw_channel *ch = &chan->vw;
+   unsigned char old[VWIRE_PIN_PTT_INVERT + 1];
+   unsigned char new[ARRAY_SIZE(old)];
+   int err;
+
+   mutex_lock(&vwire_cfg_lock);
+
+   /* under the lock, or a change of another pin at the same time is lost */
+   old[VWIRE_PIN_TX] = ch->transmitter.gpio;
+   old[VWIRE_PIN_RX] = ch->receiver.gpio;
+   old[VWIRE_PIN_PTT] = ch->ptt.gpio;
+   old[VWIRE_PIN_LED] = ch->led.gpio;
+   old[VWIRE_PIN_PTT_INVERT] = ch->ptt_inverted;
+   memcpy(new, old, sizeof(new));
+   new[which] = value;
+
+   down_write(&vwire_cfg_sem);
+
+   vwire_quiesce();
+
+   if (vwire_rx_mode == VWIRE_RX_MODE_EDGE)
+      vwire_edge_cleanup(chan);
+
+   err = vwire_setup_pins(chan, new);
+   if (err) {
+      printk(KERN_ERR VWIRE_DRV_NAME ": %s: new pins refused (%d), keeping the old ones\n", 
+            chan->name, err);
+      if (vwire_rx_mode == VWIRE_RX_MODE_EDGE)
+         vwire_edge_cleanup(chan);
+      if (vwire_setup_pins(chan, old))
+         printk(KERN_ERR VWIRE_DRV_NAME ": %s: lost the old pins too\n", chan->name);
+   }
+
+   vwire_resume();
+
+   up_write(&vwire_cfg_sem);
+   mutex_unlock(&vwire_cfg_lock);
+
+   return err;
+}
+
+/* --- protocol callbacks, called at interrupt level, or from the decode
+ * worker in deferred mode */
+static void vwire_rx_done(struct vw_channel *ch)
+{
+   struct vwire_chan *chan = ch->priv;
+
+   if (wq_has_sleeper(&chan->rx_wait))
+      wake_up_interruptible(&chan->rx_wait);
+
+   /* does nothing while the interface is down */
+   if (chan->net)
+      napi_schedule(&chan->net->napi);
+}
+
+/* CLOCK_MONOTONIC time of the receiver sample samples_ago before the 
+ * one just taken */
+static u64 vwire_rx_timestamp(struct vw_channel *ch, u32 samples_ago)
+{
+   return ktime_get_ns() - (u64)samples_ago * vwire_sample_ns(ch->samples_per_bit);
+}
+
+static void vwire_tx_done(struct vw_channel *ch)
+{
+   struct vwire_chan *chan = ch->priv;
+
+   if (wq_has_sleeper(&chan->tx_wait))
+      wake_up_interruptible(&chan->tx_wait);
+}
+
+/* Wait for room in the transmit queue, with tx_lock held */
+static int vwire_tx_wait(struct vwire_chan *chan, bool nonblock)
+{
+   struct vw_channel *ch = &chan->vw;
+   int err;
+
+   while (vw_tx_queue_full(ch)) {
+      if (nonblock)
+         return -EAGAIN;
+      err = wait_event_interruptible(chan->tx_wait, !vw_tx_queue_full(ch));
+      if (err) return err;
+   }
+   return 0;
+}
+
+/* Queue one message once vwire_tx_wait() found room */
+static void vwire_tx_put(struct vwire_chan *chan, const unsigned char *buf, unsigned char len)
+{
+   down_read(&vwire_cfg_sem);
+   vw_send(&chan->vw, buf, len);
+   vwire_kick_sample_timer();
+   up_read(&vwire_cfg_sem);
+}
+
+/* Queue a message for the transmitter.  Sleeps while the transmit queue 
+ * is full unless nonblock is set.  With vwire_frag a long message goes 
+ * out as several fragments back to back; only the first one can fail 
+ * with -EAGAIN, so a message is not left half sent unless a signal 
+ * interrupts it, and the receiver then drops it after its timeout. */
+static int vwire_send(struct vwire_chan *chan, const unsigned char *buf, size_t count, bool nonblock)
+{
+   unsigned char frag[VW_MAX_PAYLOAD];
+   unsigned int i, frags;
+   int err = 0;
+
+   if (chan->vw.transmitter.label == NULL)
+      return -ENXIO;
+
+   if (count > (vwire_frag ? VW_FRAG_MAX_LEN : VW_MAX_PAYLOAD))
+      return -EMSGSIZE;
+
+   if (mutex_lock_interruptible(&chan->tx_lock))
+      return -ERESTARTSYS;
+
+   if (!vwire_frag) {
+      err = vwire_tx_wait(chan, nonblock);
+      if (!err)
+         vwire_tx_put(chan, buf, count);
+      goto out;
+   }
+
+   frags = vw_frag_count(count);
+   for (i = 0; i < frags; i++) {
+      err = vwire_tx_wait(chan, nonblock && i == 0);
+      if (err) goto out;
+      vwire_tx_put(chan, frag, vw_frag_build(chan->frag_tx_id, buf, count, i, frag));
+   }
+   chan->frag_tx_id++;
+
+out:
+   mutex_unlock(&chan->tx_lock);
+   return err;
+}
+
+/* --- readers */
+static int vwire_reader_init(struct vwire_reader *reader, struct vwire_chan *chan,
+                             struct vw_rx_cursor *cursor)
+{
+   reader->chan = chan;
+   reader->cursor = cursor;
+   mutex_init(&reader->lock);
+   vw_rx_cursor_init(&chan->vw, cursor);
+
+   if (vwire_frag) {
+      reader->frag_rx = kzalloc(sizeof(*reader->frag_rx), GFP_KERNEL);
+      if (!reader->frag_rx)
+         return -ENOMEM;
+      vw_frag_rx_init(reader->frag_rx, msecs_to_jiffies(vwire_frag_timeout_ms));
+   }
+   return 0;
+}
+
+static void vwire_reader_cleanup(struct vwire_reader *reader)
+{
+   kfree(reader->frag_rx);
+   reader->frag_rx = NULL;
+}
+
+static bool vwire_reader_have(struct vwire_reader *reader)
+{
+   return vw_rx_cursor_have(&reader->chan->vw, reader->cursor);
+}
+
+/* Take the next message for this reader, with its lock held and 
+ * vwire_reader_have() true.  Without vwire_frag it may have a bad FCS,
+ * see reader->meta.crc_ok.  With vwire_frag it is a fragment for the 
+ * reassembly, and -EAGAIN is returned until a message is complete; 
+ * reader->meta is then that of its last fragment.
+ * *msg is valid until the next call. */
+static int vwire_recv(struct vwire_reader *reader, const unsigned char **msg)
+{
+   unsigned char len = sizeof(reader->frame);
+   unsigned int msg_len;
+   bool ok;
+
+   ok = vw_rx_cursor_get(&reader->chan->vw, reader->cursor, reader->frame, &len, &reader->meta);
+   if (!vwire_frag) {
+      *msg = reader->frame;
+      return len;
+   }
+
+   /* a fragment with a bad FCS can not be placed */
+   if (!ok)
+      return -EAGAIN;
+
+   *msg = vw_frag_rx_put(reader->frag_rx, reader->frame, len, &msg_len);
+   return *msg ? msg_len : -EAGAIN;
+}
+
 /* --- callback functions for sysfs */
 static ssize_t vwire_send_message(struct device *dev,
                                  struct device_attribute *attr,
                                  const char* buf,
                                  size_t count)
 {
+   struct vwire_chan *chan = dev_get_drvdata(dev);
+   int err;
    
-   if (vw_send(buf, count)) {
-      /* the message was sent */
-      printk(KERN_INFO VWIRE_DRV_NAME ": sent message %s\n", buf);
-   }
-   else {
-      /* there was a problem */
-      printk(KERN_INFO VWIRE_DRV_NAME ": message was not sent \n");
+   err = vwire_send(chan, buf, count, false);
+   if (err) {
+      /* there was a problem, tell the writer */
+      printk(KERN_INFO VWIRE_DRV_NAME ": %s message was not sent (%d)\n", chan->name, err);
+      return err;
    }
 
+   /* the message was sent */
+   if (vwire_verbose)
+      printk(KERN_INFO VWIRE_DRV_NAME ": %s sent message %.*s\n", chan->name, (int)count, buf);
    return count;
 }
 
@@ -120,18 +913,269 @@ static ssize_t vwire_get_message(struct device *dev,
                                  struct device_attribute *attr,
                                  char *buf)
 {
-   unsigned char len = VWIRE_MAX_MESSAGE_LEN;  /* todo max here */
+   struct vwire_chan *chan = dev_get_drvdata(dev);
+   struct vwire_reader *reader = &chan->reader;
+   const unsigned char *msg;
+   int len = 0;
+
+   /* the oldest good message, or nothing; fragments are collected and
+    * messages with a bad FCS dropped on the way */
+   mutex_lock(&reader->lock);
+   while (vwire_reader_have(reader)) {
+      len = vwire_recv(reader, &msg);
+      if (len >= 0 && reader->meta.crc_ok) {
+         memcpy(buf, msg, len);
+         break;
+      }
+      len = 0;
+   }
+   mutex_unlock(&reader->lock);
+
+   return len;
+}
+
+static ssize_t vwire_get_tx_queued(struct device *dev, 
+                                   struct device_attribute *attr,
+                                   char *buf)
+{
+   struct vwire_chan *chan = dev_get_drvdata(dev);
+
+   return scnprintf(buf, PAGE_SIZE, "%u\n", vw_tx_queue_count(&chan->vw));
+}
+
+/* /sys/class/vwire/baudrate, shared by all channels */
+static ssize_t baudrate_show(struct class *class, 
+                             struct class_attribute *attr,
+                             char *buf)
+{
+   return scnprintf(buf, PAGE_SIZE, "%u\n", vwire_baudrate);
+}
+
+static ssize_t baudrate_store(struct class *class,
+                              struct class_attribute *attr,
+                              const char *buf,
+                              size_t count)
+{
+   unsigned int baud;
+   int err;
+
+   err = kstrtouint(buf, 10, &baud);
+   if (err) return err;
+
+   err = vwire_set_baudrate(baud);
+   if (err) return err;
+
+   return count;
+}
+
+static ssize_t vwire_get_samples_per_bit(struct device *dev, 
+                                         struct device_attribute *attr,
+                                         char *buf)
+{
+   struct vwire_chan *chan = dev_get_drvdata(dev);
+
+   return scnprintf(buf, PAGE_SIZE, "%u\n", chan->vw.samples_per_bit);
+}
+
+static ssize_t vwire_set_samples_per_bit_attr(struct device *dev,
+                                              struct device_attribute *attr,
+                                              const char* buf,
+                                              size_t count)
+{
+   struct vwire_chan *chan = dev_get_drvdata(dev);
+   unsigned int spb;
+   int err;
+
+   err = kstrtouint(buf, 10, &spb);
+   if (err) return err;
 
-   if (vw_get_message(buf, &len)) {
-      /* the message should be in buf and len will be updated */
+   err = vwire_set_samples_per_bit(chan, spb);
+   if (err) return err;
+
+   return count;
+}
+
+#define VWIRE_PIN_ATTR(name, which, value) \
+static ssize_t vwire_get_##name(struct device *dev, \
+                                struct device_attribute *attr, \
+                                char *buf) \
+{ \
+   struct vwire_chan *chan = dev_get_drvdata(dev); \
+   \
+   return scnprintf(buf, PAGE_SIZE, "%u\n", value); \
+} \
+static ssize_t vwire_set_##name(struct device *dev, \
+                                struct device_attribute *attr, \
+                                const char* buf, \
+                                size_t count) \
+{ \
+   struct vwire_chan *chan = dev_get_drvdata(dev); \
+   u8 pin; \
+   int err; \
+   \
+   err = kstrtou8(buf, 10, &pin); \
+   if (err) return err; \
+   err = vwire_set_pin(chan, which, pin); \
+   if (err) return err; \
+   return count; \
+} \
+static DEVICE_ATTR(name, S_IRUGO|S_IWUSR, vwire_get_##name, vwire_set_##name)
+
+VWIRE_PIN_ATTR(tx_gpio, VWIRE_PIN_TX, chan->vw.transmitter.gpio);
+VWIRE_PIN_ATTR(rx_gpio, VWIRE_PIN_RX, chan->vw.receiver.gpio);
+VWIRE_PIN_ATTR(ptt_gpio, VWIRE_PIN_PTT, chan->vw.ptt.gpio);
+VWIRE_PIN_ATTR(led_gpio, VWIRE_PIN_LED, chan->vw.led.gpio);
+VWIRE_PIN_ATTR(ptt_invert, VWIRE_PIN_PTT_INVERT, chan->vw.ptt_inverted);
+
+static ssize_t vwire_get_dedup_ms(struct device *dev, 
+                                  struct device_attribute *attr,
+                                  char *buf)
+{
+   struct vwire_chan *chan = dev_get_drvdata(dev);
+
+   return scnprintf(buf, PAGE_SIZE, "%u\n", 
+         jiffies_to_msecs(READ_ONCE(chan->vw.rx_dedup_window)));
+}
+
+static ssize_t vwire_set_dedup_ms(struct device *dev,
+                                  struct device_attribute *attr,
+                                  const char* buf,
+                                  size_t count)
+{
+   struct vwire_chan *chan = dev_get_drvdata(dev);
+   unsigned int ms;
+   int err;
+
+   err = kstrtouint(buf, 10, &ms);
+   if (err) return err;
+   if (ms > VWIRE_DEDUP_MS_MAX)
+      return -EINVAL;
+
+   vw_set_rx_dedup(&chan->vw, msecs_to_jiffies(ms));
+   return count;
+}
+
+/* the baud rates being decoded besides vwire_baudrate */
+static ssize_t vwire_get_rx_rates(struct device *dev, 
+                                  struct device_attribute *attr,
+                                  char *buf)
+{
+   struct vwire_chan *chan = dev_get_drvdata(dev);
+   struct vw_channel *rate;
+   ssize_t len = 0;
+   unsigned int i;
+
+   mutex_lock(&vwire_cfg_lock);
+   for (i = 0; i < chan->vw.rx_rates; i++) {
+      rate = chan->vw.rx_rate[i];
+      if (rate->rx_step)
+         len += scnprintf(buf + len, PAGE_SIZE - len, "%s%u", len ? " " : "", vwire_rx_rates[i]);
    }
-   else {
-      len = 0;
+   mutex_unlock(&vwire_cfg_lock);
+
+   len += scnprintf(buf + len, PAGE_SIZE - len, "\n");
+   return len;
+}
+
+/* Parse receive filter rules "offset mask value min_len max_len", one per
+ * line or separated by ';', numbers in C notation.  No rules is a filter
+ * with count 0. */
+static int vwire_parse_filter(char *text, struct vw_rx_filter *filter)
+{
+   unsigned int offset, min_len, max_len;
+   int mask, value, end;
+   char *rule;
+
+   filter->count = 0;
+   while ((rule = strsep(&text, ";\n")) != NULL) {
+      rule = strim(rule);
+      if (!*rule)
+         continue;
+      if (filter->count == VW_RX_FILTER_MAX)
+         return -ENOSPC;
+
+      if (sscanf(rule, "%u %i %i %u %u %n", &offset, &mask, &value,
+                 &min_len, &max_len, &end) != 5 || rule[end])
+         return -EINVAL;
+      if (offset >= VW_MAX_PAYLOAD || mask < 0 || mask > 0xff
+            || value < 0 || (value & ~mask)
+            || min_len > max_len || max_len > VW_MAX_PAYLOAD)
+         return -EINVAL;
+
+      filter->rule[filter->count++] = (struct vw_rx_rule) {
+         .offset = offset, .mask = mask, .value = value,
+         .min_len = min_len, .max_len = max_len,
+      };
    }
+   return 0;
+}
+
+static ssize_t vwire_get_filter(struct device *dev, 
+                                struct device_attribute *attr,
+                                char *buf)
+{
+   struct vwire_chan *chan = dev_get_drvdata(dev);
+   const struct vw_rx_filter *filter;
+   const struct vw_rx_rule *rule;
+   ssize_t len = 0;
+   unsigned int i;
+
+   mutex_lock(&vwire_cfg_lock);
+   filter = rcu_dereference_protected(chan->vw.rx_filter, lockdep_is_held(&vwire_cfg_lock));
+   for (i = 0; filter && i < filter->count; i++) {
+      rule = &filter->rule[i];
+      len += scnprintf(buf + len, PAGE_SIZE - len, "%u 0x%02x 0x%02x %u %u\n",
+                       rule->offset, rule->mask, rule->value, rule->min_len, rule->max_len);
+   }
+   mutex_unlock(&vwire_cfg_lock);
 
    return len;
 }
 
+/* Replace the receive filter, writing no rules removes it */
+static ssize_t vwire_set_filter(struct device *dev,
+                                struct device_attribute *attr,
+                                const char* buf,
+                                size_t count)
+{
+   struct vwire_chan *chan = dev_get_drvdata(dev);
+   const struct vw_rx_filter *old;
+   struct vw_rx_filter *filter;
+   char *text;
+   int err;
+
+   filter = kzalloc(sizeof(*filter), GFP_KERNEL);
+   text = kstrndup(buf, count, GFP_KERNEL);
+   if (!filter || !text) {
+      err = -ENOMEM;
+      goto out;
+   }
+
+   err = vwire_parse_filter(text, filter);
+   if (err) goto out;
+
+   if (!filter->count) {
+      kfree(filter);
+      filter = NULL;
+   }
+
+   mutex_lock(&vwire_cfg_lock);
+   old = vw_set_rx_filter(&chan->vw, filter);
+   mutex_unlock(&vwire_cfg_lock);
+   filter = NULL;
+
+   /* the PLL runs with preemption off, so once every CPU has scheduled
+    * it is done with the old filter */
+   synchronize_rcu();
+   kfree(old);
+   err = count;
+
+out:
+   kfree(text);
+   kfree(filter);
+   return err;
+}
+
 static ssize_t vwire_set_verbose(struct device *dev,
                                  struct device_attribute *attr,
                                  const char* buf,
@@ -167,93 +1211,896 @@ static ssize_t vwire_get_verbose(struct device *dev,
 static DEVICE_ATTR(send, S_IWUSR, NULL, vwire_send_message);  /* write only */
 static DEVICE_ATTR(receive, S_IRUSR, vwire_get_message, NULL);   /* read only */
 static DEVICE_ATTR(verbose, S_IRUSR|S_IWUSR, vwire_get_verbose, vwire_set_verbose);  /* root rw, others read */
+static DEVICE_ATTR(tx_queued, S_IRUGO, vwire_get_tx_queued, NULL);   /* read only */
+static DEVICE_ATTR(samples_per_bit, S_IRUGO|S_IWUSR, vwire_get_samples_per_bit, vwire_set_samples_per_bit_attr);
+static DEVICE_ATTR(filter, S_IRUGO|S_IWUSR, vwire_get_filter, vwire_set_filter);
+static DEVICE_ATTR(dedup_ms, S_IRUGO|S_IWUSR, vwire_get_dedup_ms, vwire_set_dedup_ms);
+static DEVICE_ATTR(rx_rates, S_IRUGO, vwire_get_rx_rates, NULL);   /* read only */
+static CLASS_ATTR_RW(baudrate);  /* root rw, others read */
+
+/* created on every channel device */
+static struct device_attribute *vwire_dev_attrs[] = {
+   &dev_attr_receive,
+   &dev_attr_send,
+   &dev_attr_verbose,
+   &dev_attr_tx_queued,
+   &dev_attr_tx_gpio,
+   &dev_attr_rx_gpio,
+   &dev_attr_ptt_gpio,
+   &dev_attr_led_gpio,
+   &dev_attr_ptt_invert,
+   &dev_attr_samples_per_bit,
+   &dev_attr_filter,
+   &dev_attr_dedup_ms,
+   &dev_attr_rx_rates,
+};
+
+/* --- protocol counters, /sys/class/vwire/<name>/stats/ */
+#define VWIRE_STAT_ATTR(field) \
+static ssize_t vwire_stat_##field(struct device *dev, \
+                                  struct device_attribute *attr, \
+                                  char *buf) \
+{ \
+   struct vwire_chan *chan = dev_get_drvdata(dev); \
+   struct vw_stats stats; \
+   \
+   vw_get_stats(&chan->vw, &stats); \
+   return scnprintf(buf, PAGE_SIZE, "%llu\n", (unsigned long long)stats.field); \
+} \
+static DEVICE_ATTR(field, S_IRUGO, vwire_stat_##field, NULL)
+
+VWIRE_STAT_ATTR(rx_start);
+VWIRE_STAT_ATTR(rx_length_err);
+VWIRE_STAT_ATTR(rx_symbol_err);
+VWIRE_STAT_ATTR(rx_crc_err);
+VWIRE_STAT_ATTR(rx_good);
+VWIRE_STAT_ATTR(rx_overflow);
+VWIRE_STAT_ATTR(tx_frames);
+VWIRE_STAT_ATTR(tx_airtime_ns);
+VWIRE_STAT_ATTR(tx_full);
+VWIRE_STAT_ATTR(rx_capture_lost);
+VWIRE_STAT_ATTR(rx_filtered);
+VWIRE_STAT_ATTR(rx_duplicate);
+
+/* reassembly counters of the receive attribute, 0 without vwire_frag */
+#define VWIRE_FRAG_STAT_ATTR(field) \
+static ssize_t vwire_stat_frag_##field(struct device *dev, \
+                                       struct device_attribute *attr, \
+                                       char *buf) \
+{ \
+   struct vwire_chan *chan = dev_get_drvdata(dev); \
+   \
+   return scnprintf(buf, PAGE_SIZE, "%u\n", \
+         chan->reader.frag_rx ? READ_ONCE(chan->reader.frag_rx->field) : 0); \
+} \
+static DEVICE_ATTR(frag_##field, S_IRUGO, vwire_stat_frag_##field, NULL)
+
+VWIRE_FRAG_STAT_ATTR(complete);
+VWIRE_FRAG_STAT_ATTR(timed_out);
+VWIRE_FRAG_STAT_ATTR(evicted);
+VWIRE_FRAG_STAT_ATTR(invalid);
+
+/* any write starts the counters again from 0 */
+static ssize_t vwire_stats_reset(struct device *dev,
+                                 struct device_attribute *attr,
+                                 const char* buf,
+                                 size_t count)
+{
+   struct vwire_chan *chan = dev_get_drvdata(dev);
+
+   mutex_lock(&chan->stats_lock);
+   vw_reset_stats(&chan->vw);
+   mutex_unlock(&chan->stats_lock);
+
+   /* the reassembly counters are only written by readers */
+   if (chan->reader.frag_rx) {
+      mutex_lock(&chan->reader.lock);
+      chan->reader.frag_rx->complete = 0;
+      chan->reader.frag_rx->timed_out = 0;
+      chan->reader.frag_rx->evicted = 0;
+      chan->reader.frag_rx->invalid = 0;
+      mutex_unlock(&chan->reader.lock);
+   }
+
+   return count;
+}
+
+static DEVICE_ATTR(reset, S_IWUSR, NULL, vwire_stats_reset);  /* write only */
+
+static struct attribute *vwire_stats_attrs[] = {
+   &dev_attr_rx_start.attr,
+   &dev_attr_rx_length_err.attr,
+   &dev_attr_rx_symbol_err.attr,
+   &dev_attr_rx_crc_err.attr,
+   &dev_attr_rx_good.attr,
+   &dev_attr_rx_overflow.attr,
+   &dev_attr_tx_frames.attr,
+   &dev_attr_tx_airtime_ns.attr,
+   &dev_attr_tx_full.attr,
+   &dev_attr_rx_capture_lost.attr,
+   &dev_attr_rx_filtered.attr,
+   &dev_attr_rx_duplicate.attr,
+   &dev_attr_frag_complete.attr,
+   &dev_attr_frag_timed_out.attr,
+   &dev_attr_frag_evicted.attr,
+   &dev_attr_frag_invalid.attr,
+   &dev_attr_reset.attr,
+   NULL,
+};
+
+static const struct attribute_group vwire_stats_group = {
+   .name    = "stats",
+   .attrs   = vwire_stats_attrs,
+};
 
 
 /* --- end device attributes */
 
 
+/* --- character device, /dev/vwire, /dev/vwire1, ... */
+static struct vwire_chan *vwire_file_chan(struct file *filp)
+{
+   struct vwire_reader *reader = filp->private_data;
+
+   return reader->chan;
+}
 
-static int vwire_fs_init(void)
+/* Every open file reads all messages that arrive after the open */
+static int vwire_dev_open(struct inode *inode, struct file *filp)
 {
-   int err = 0;
+   /* the misc core points private_data at our miscdevice on open */
+   struct vwire_chan *chan = container_of(filp->private_data, struct vwire_chan, misc);
+   struct vwire_reader *reader;
+   int err;
+
+   reader = kzalloc(sizeof(*reader), GFP_KERNEL);
+   if (!reader)
+      return -ENOMEM;
+
+   err = vwire_reader_init(reader, chan, &reader->file_cursor);
+   if (err) {
+      vwire_reader_cleanup(reader);
+      kfree(reader);
+      return err;
+   }
 
-   device_class = class_create(THIS_MODULE, VWIRE_DEV_NAME);
-   err |= IS_ERR(device_class);
+   filp->private_data = reader;
+   return nonseekable_open(inode, filp);
+}
+
+static int vwire_dev_release(struct inode *inode, struct file *filp)
+{
+   struct vwire_reader *reader = filp->private_data;
 
-   device_object = device_create(device_class, NULL, 0, NULL, VWIRE_DEV_NAME);
-   err |= IS_ERR(device_object);
+   vwire_reader_cleanup(reader);
+   kfree(reader);
+   return 0;
+}
+
+/* Each read returns one message, truncated to the buffer size */
+static ssize_t vwire_dev_read(struct file *filp, char __user *ubuf,
+                              size_t count, loff_t *ppos)
+{
+   struct vwire_reader *reader = filp->private_data;
+   struct vwire_chan *chan = reader->chan;
+   struct vwire_rx_record rec;
+   const unsigned char *msg;
+   unsigned int format;
+   int len, err;
+
+   /* a record has to fit */
+   format = READ_ONCE(reader->format);
+   if (format == VWIRE_RX_FORMAT_RECORD && count < sizeof(rec))
+      return -EINVAL;
+
+   for (;;) {
+      if (mutex_lock_interruptible(&reader->lock))
+         return -ERESTARTSYS;
+      while (vwire_reader_have(reader)) {
+         len = vwire_recv(reader, &msg);
+         /* only a record can tell a bad checksum from a good one */
+         if (len >= 0 && (reader->meta.crc_ok || format == VWIRE_RX_FORMAT_RECORD))
+            goto found;
+      }
+      mutex_unlock(&reader->lock);
+
+      if (filp->f_flags & O_NONBLOCK)
+         return -EAGAIN;
+
+      err = wait_event_interruptible(chan->rx_wait, vwire_reader_have(reader));
+      if (err) return err;
+   }
 
-   err |= device_create_file(device_object, &dev_attr_receive);
-   err |= device_create_file(device_object, &dev_attr_send);
-   err |= device_create_file(device_object, &dev_attr_verbose);
+found:
+   /* msg lives in the reader until the next vwire_recv() */
+   if (format == VWIRE_RX_FORMAT_RECORD) {
+      memset(&rec, 0, sizeof(rec));
+      rec.ts_ns = reader->meta.time_ns;
+      rec.quality = reader->meta.quality;
+      rec.baud = reader->meta.baud;
+      if (reader->meta.crc_ok)
+         rec.flags |= VWIRE_RX_CRC_OK;
+      if (len > count - sizeof(rec)) {
+         rec.flags |= VWIRE_RX_TRUNCATED;
+         len = count - sizeof(rec);
+      }
+      rec.len = len;
+
+      if (copy_to_user(ubuf, &rec, sizeof(rec)) 
+            || copy_to_user(ubuf + sizeof(rec), msg, len))
+         err = -EFAULT;
+      else
+         err = sizeof(rec) + len;
+   }
+   else {
+      len = min_t(size_t, count, len);
+      err = copy_to_user(ubuf, msg, len) ? -EFAULT : len;
+   }
+   mutex_unlock(&reader->lock);
 
    return err;
 }
 
-static void vwire_fs_cleanup(void)
+/* Each write is sent as one message */
+static ssize_t vwire_dev_write(struct file *filp, const char __user *ubuf,
+                               size_t count, loff_t *ppos)
 {
-   device_remove_file(device_object, &dev_attr_receive);
-   device_remove_file(device_object, &dev_attr_send);
-   device_remove_file(device_object, &dev_attr_verbose);
+   struct vwire_chan *chan = vwire_file_chan(filp);
+   unsigned char *buf;
+   int err;
 
-   device_destroy(device_class, 0);
-   class_destroy(device_class);
+   if (count > (vwire_frag ? VW_FRAG_MAX_LEN : VW_MAX_PAYLOAD))
+      return -EMSGSIZE;
+
+   buf = memdup_user(ubuf, count);
+   if (IS_ERR(buf))
+      return PTR_ERR(buf);
+
+   err = vwire_send(chan, buf, count, filp->f_flags & O_NONBLOCK);
+   kfree(buf);
+   if (err) return err;
+
+   return count;
+}
+
+static __poll_t vwire_dev_poll(struct file *filp, poll_table *wait)
+{
+   struct vwire_reader *reader = filp->private_data;
+   struct vwire_chan *chan = reader->chan;
+   __poll_t mask = 0;
+
+   poll_wait(filp, &chan->rx_wait, wait);
+   poll_wait(filp, &chan->tx_wait, wait);
 
-#if 0
-	device_remove_file(&interface->dev, &dev_attr_blue);
-	device_remove_file(&interface->dev, &dev_attr_red);
-	device_remove_file(&interface->dev, &dev_attr_green);
+   if (vwire_reader_have(reader))
+      mask |= EPOLLIN | EPOLLRDNORM;
+   if (chan->vw.transmitter.label && !vw_tx_queue_full(&chan->vw))
+      mask |= EPOLLOUT | EPOLLWRNORM;
+
+   return mask;
+}
+
+/* The receive ring, read only, for readers that take the messages in
+ * place; VWIRE_IOC_RX_WAIT is their wakeup */
+static int vwire_dev_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+   struct vwire_chan *chan = vwire_file_chan(filp);
+
+   if (vma->vm_flags & VM_WRITE)
+      return -EPERM;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,3,0)
+   vm_flags_clear(vma, VM_MAYWRITE);
+#else
+   vma->vm_flags &= ~VM_MAYWRITE;
 #endif
+
+   return remap_vmalloc_range(vma, chan->rx_ring, vma->vm_pgoff);
 }
 
-static int __init vwire_init_module(void)
+/* Move the file's cursor to where a reader of the mapped ring is, and 
+ * wait there for a message */
+static long vwire_rx_wait(struct file *filp, __u32 tail)
+{
+   struct vwire_reader *reader = filp->private_data;
+   struct vwire_chan *chan = reader->chan;
+   u32 head;
+
+   if (mutex_lock_interruptible(&reader->lock))
+      return -ERESTARTSYS;
+
+   /* a tail past the head is taken as the head */
+   head = READ_ONCE(chan->rx_ring->head);
+   if ((s32)(tail - head) > 0)
+      tail = head;
+   reader->cursor->seq = tail;
+   mutex_unlock(&reader->lock);
+
+   if (vwire_reader_have(reader))
+      return 0;
+   if (filp->f_flags & O_NONBLOCK)
+      return -EAGAIN;
+
+   return wait_event_interruptible(chan->rx_wait, vwire_reader_have(reader));
+}
+
+static long vwire_dev_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+   struct vwire_reader *reader = filp->private_data;
+   __u32 format, tail;
+
+   switch (cmd) {
+   case VWIRE_IOC_RX_DROPPED:
+      return put_user(READ_ONCE(reader->cursor->dropped), (__u32 __user *)arg);
+   case VWIRE_IOC_SET_RX_FORMAT:
+      if (get_user(format, (__u32 __user *)arg))
+         return -EFAULT;
+      if (format != VWIRE_RX_FORMAT_PAYLOAD && format != VWIRE_RX_FORMAT_RECORD)
+         return -EINVAL;
+      WRITE_ONCE(reader->format, format);
+      return 0;
+   case VWIRE_IOC_RX_WAIT:
+      if (get_user(tail, (__u32 __user *)arg))
+         return -EFAULT;
+      return vwire_rx_wait(filp, tail);
+   default:
+      return -ENOTTY;
+   }
+}
+
+static const struct file_operations vwire_dev_fops = {
+   .owner            = THIS_MODULE,
+   .read             = vwire_dev_read,
+   .write            = vwire_dev_write,
+   .poll             = vwire_dev_poll,
+   .mmap             = vwire_dev_mmap,
+   .unlocked_ioctl   = vwire_dev_ioctl,
+   .compat_ioctl     = compat_ptr_ioctl,
+   .open             = vwire_dev_open,
+   .release          = vwire_dev_release,
+   .llseek           = no_llseek,
+};
+
+/* --- end character device */
+
+
+/* --- network interface, /sys/class/net/vwire, ... */
+
+/* What the stack should make of a received message: IP if it looks like
+ * it, as tun does, else the local experimental ethertype */
+static __be16 vwire_net_type(const unsigned char *msg, int len)
+{
+   switch (len ? msg[0] & 0xf0 : 0) {
+   case 0x40:
+      return htons(ETH_P_IP);
+   case 0x60:
+      return htons(ETH_P_IPV6);
+   default:
+      return htons(ETH_P_802_EX1);
+   }
+}
+
+static int vwire_net_poll(struct napi_struct *napi, int budget)
+{
+   struct vwire_net *net = container_of(napi, struct vwire_net, napi);
+   struct vwire_reader *reader = &net->reader;
+   const unsigned char *msg;
+   struct sk_buff *skb;
+   int len, done = 0;
+
+   while (done < budget && vwire_reader_have(reader)) {
+      len = vwire_recv(reader, &msg);
+      if (len < 0)
+         continue;   /* a fragment, its message is not complete yet */
+
+      if (!reader->meta.crc_ok) {
+         u64_stats_update_begin(&net->rx_syncp);
+         net->rx_crc_errors++;
+         u64_stats_update_end(&net->rx_syncp);
+         continue;
+      }
+
+      skb = napi_alloc_skb(napi, len);
+      if (!skb) {
+         u64_stats_update_begin(&net->rx_syncp);
+         net->rx_dropped++;
+         u64_stats_update_end(&net->rx_syncp);
+         continue;
+      }
+      skb_put_data(skb, msg, len);
+      skb->dev = net->dev;
+      skb->protocol = vwire_net_type(msg, len);
+      skb->pkt_type = PACKET_HOST;
+      skb_reset_mac_header(skb);
+      skb_reset_network_header(skb);
+
+      u64_stats_update_begin(&net->rx_syncp);
+      net->rx_packets++;
+      net->rx_bytes += len;
+      u64_stats_update_end(&net->rx_syncp);
+
+      netif_receive_skb(skb);
+      done++;
+   }
+
+   /* anything queued meanwhile schedules the poll again */
+   if (done < budget)
+      napi_complete_done(napi, done);
+   return done;
+}
+
+/* Send what ndo_start_xmit() took, sleeping for room like a blocking 
+ * write, and let the qdisc go on once the backlog is short again */
+static void vwire_net_tx_work(struct work_struct *work)
+{
+   struct vwire_net *net = container_of(work, struct vwire_net, tx_work);
+   struct sk_buff *skb;
+   int err;
+
+   while ((skb = skb_dequeue(&net->txq)) != NULL) {
+      err = vwire_send(net->chan, skb->data, skb->len, false);
+
+      u64_stats_update_begin(&net->tx_syncp);
+      if (err) {
+         net->tx_errors++;
+      }
+      else {
+         net->tx_packets++;
+         net->tx_bytes += skb->len;
+      }
+      u64_stats_update_end(&net->tx_syncp);
+      dev_consume_skb_any(skb);
+
+      if (skb_queue_len(&net->txq) < VWIRE_NET_TX_BACKLOG)
+         netif_wake_queue(net->dev);
+   }
+   netif_wake_queue(net->dev);
+}
+
+static netdev_tx_t vwire_net_xmit(struct sk_buff *skb, struct net_device *dev)
+{
+   struct vwire_net *net = netdev_priv(dev);
+
+   /* vwire_send() takes one flat buffer */
+   if (skb->len > dev->mtu || skb_linearize(skb)) {
+      atomic_long_inc(&net->tx_dropped);
+      dev_kfree_skb_any(skb);
+      return NETDEV_TX_OK;
+   }
+
+   skb_queue_tail(&net->txq, skb);
+   if (skb_queue_len(&net->txq) >= VWIRE_NET_TX_BACKLOG)
+      netif_stop_queue(dev);
+   queue_work(system_unbound_wq, &net->tx_work);
+
+   return NETDEV_TX_OK;
+}
+
+static int vwire_net_open(struct net_device *dev)
+{
+   struct vwire_net *net = netdev_priv(dev);
+
+   /* messages from before the interface came up are not delivered */
+   vw_rx_cursor_init(&net->chan->vw, net->reader.cursor);
+   napi_enable(&net->napi);
+   netif_start_queue(dev);
+   return 0;
+}
+
+static int vwire_net_stop(struct net_device *dev)
+{
+   struct vwire_net *net = netdev_priv(dev);
+
+   netif_stop_queue(dev);
+   napi_disable(&net->napi);
+   cancel_work_sync(&net->tx_work);
+   skb_queue_purge(&net->txq);
+   return 0;
+}
+
+static void vwire_net_get_stats64(struct net_device *dev, struct rtnl_link_stats64 *stats)
+{
+   struct vwire_net *net = netdev_priv(dev);
+   struct vw_stats vw;
+   unsigned int start;
+
+   do {
+      start = u64_stats_fetch_begin(&net->rx_syncp);
+      stats->rx_packets = net->rx_packets;
+      stats->rx_bytes = net->rx_bytes;
+      stats->rx_crc_errors = net->rx_crc_errors;
+      stats->rx_dropped = net->rx_dropped;
+   } while (u64_stats_fetch_retry(&net->rx_syncp, start));
+
+   do {
+      start = u64_stats_fetch_begin(&net->tx_syncp);
+      stats->tx_packets = net->tx_packets;
+      stats->tx_bytes = net->tx_bytes;
+      stats->tx_errors = net->tx_errors;
+   } while (u64_stats_fetch_retry(&net->tx_syncp, start));
+
+   stats->tx_dropped = atomic_long_read(&net->tx_dropped);
+
+   /* overwritten before the poll got to them */
+   stats->rx_missed_errors = READ_ONCE(net->reader.cursor->dropped);
+
+   /* and what the receiver dropped before there was a message at all */
+   vw_get_stats(&net->chan->vw, &vw);
+   stats->rx_length_errors = vw.rx_length_err;
+   stats->rx_frame_errors = vw.rx_symbol_err;
+   stats->rx_errors = stats->rx_crc_errors + stats->rx_length_errors + stats->rx_frame_errors;
+}
+
+static const struct net_device_ops vwire_netdev_ops = {
+   .ndo_open         = vwire_net_open,
+   .ndo_stop         = vwire_net_stop,
+   .ndo_start_xmit   = vwire_net_xmit,
+   .ndo_get_stats64  = vwire_net_get_stats64,
+};
+
+/* A point to point link without addresses or link layer header */
+static void vwire_net_setup(struct net_device *dev)
+{
+   dev->netdev_ops = &vwire_netdev_ops;
+   dev->type = ARPHRD_NONE;
+   dev->flags = IFF_POINTOPOINT | IFF_NOARP;
+   dev->hard_header_len = 0;
+   dev->addr_len = 0;
+   dev->tx_queue_len = VWIRE_NET_TX_QUEUE_LEN;
+   dev->min_mtu = 1;
+}
+
+static int vwire_net_init(struct vwire_chan *chan)
+{
+   struct net_device *dev;
+   struct vwire_net *net;
+   int err;
+
+   dev = alloc_netdev(sizeof(*net), chan->name, NET_NAME_PREDICTABLE, vwire_net_setup);
+   if (!dev)
+      return -ENOMEM;
+
+   net = netdev_priv(dev);
+   net->chan = chan;
+   net->dev = dev;
+   dev->mtu = dev->max_mtu = vwire_frag ? VW_FRAG_MAX_LEN : VW_MAX_PAYLOAD;
+   skb_queue_head_init(&net->txq);
+   INIT_WORK(&net->tx_work, vwire_net_tx_work);
+   u64_stats_init(&net->rx_syncp);
+   u64_stats_init(&net->tx_syncp);
+   netif_napi_add(dev, &net->napi, vwire_net_poll);
+
+   err = vwire_reader_init(&net->reader, chan, &net->reader.file_cursor);
+   if (err) goto fail_reader;
+
+   /* rx_done can only schedule the poll once the interface is up */
+   chan->net = net;
+   err = register_netdev(dev);
+   if (err) goto fail_register;
+
+   return 0;
+
+fail_register:
+   chan->net = NULL;
+fail_reader:
+   vwire_reader_cleanup(&net->reader);
+   netif_napi_del(&net->napi);
+   free_netdev(dev);
+   return err;
+}
+
+/* Take the interface away, while the sample timer still runs so a send
+ * in progress can finish */
+static void vwire_net_remove(struct vwire_chan *chan)
+{
+   if (chan->net)
+      unregister_netdev(chan->net->dev);
+}
+
+/* Free it once the sample timer has stopped */
+static void vwire_net_cleanup(struct vwire_chan *chan)
+{
+   struct vwire_net *net = chan->net;
+
+   if (!net)
+      return;
+
+   chan->net = NULL;
+   netif_napi_del(&net->napi);
+   vwire_reader_cleanup(&net->reader);
+   free_netdev(net->dev);
+}
+/* --- end network interface */
+
+
+
+static int vwire_fs_init(struct vwire_chan *chan)
 {
    int err = 0;
-   ktime_t ktime;
+   int i;
 
-   printk(KERN_INFO VWIRE_DRV_NAME ": %s\n", __func__);
+   chan->dev = device_create(device_class, NULL, 0, chan, chan->name);
+   if (IS_ERR(chan->dev)) {
+      err = PTR_ERR(chan->dev);
+      chan->dev = NULL;
+      return err;
+   }
+
+   for (i = 0; i < ARRAY_SIZE(vwire_dev_attrs); i++)
+      err |= device_create_file(chan->dev, vwire_dev_attrs[i]);
+
+   err |= sysfs_create_group(&chan->dev->kobj, &vwire_stats_group);
+
+   return err;
+}
 
-   /* to start disable tx and rx */
-   vw_tx_stop();
-   vw_rx_stop();
+static void vwire_fs_cleanup(struct vwire_chan *chan)
+{
+   int i;
+
+   if (chan->dev == NULL)
+      return;
+
+   sysfs_remove_group(&chan->dev->kobj, &vwire_stats_group);
+   for (i = 0; i < ARRAY_SIZE(vwire_dev_attrs); i++)
+      device_remove_file(chan->dev, vwire_dev_attrs[i]);
+
+   device_unregister(chan->dev);
+   chan->dev = NULL;
+}
+
+/* A decoder for each of vwire_rx_rates, fed from the channel's samples.
+ * Every channel gets them, the receiver pin may be set later. */
+static int vwire_rates_init(struct vwire_chan *chan)
+{
+   struct vw_channel *rate;
+   int i;
+
+   for (i = 0; i < vwire_rx_rates_num; i++) {
+      rate = kzalloc(sizeof(*rate), GFP_KERNEL);
+      if (!rate)
+         return -ENOMEM;
+      vw_add_rx_rate(&chan->vw, rate);
+   }
+   vwire_rates_setup(chan);
+   return 0;
+}
+
+/* Undo vwire_rates_init(), after the channel has let go of them */
+static void vwire_rates_cleanup(struct vwire_chan *chan)
+{
+   unsigned int i;
+
+   for (i = 0; i < chan->vw.rx_rates; i++)
+      kfree(chan->vw.rx_rate[i]);
+   chan->vw.rx_rates = 0;
+}
+
+/* Bring up one channel: pins, sysfs, edge interrupt and /dev node.  The
+ * sample timer is not running yet. */
+static int vwire_chan_init(struct vwire_chan *chan, unsigned int index)
+{
+   struct vw_channel *ch = &chan->vw;
+   int err = 0;
+
+   if (index == 0)
+      snprintf(chan->name, sizeof(chan->name), "%s", VWIRE_DEV_NAME);
+   else
+      snprintf(chan->name, sizeof(chan->name), "%s%u", VWIRE_DEV_NAME, index);
+
+   mutex_init(&chan->tx_lock);
+   mutex_init(&chan->stats_lock);
+   init_waitqueue_head(&chan->rx_wait);
+   init_waitqueue_head(&chan->tx_wait);
+   spin_lock_init(&chan->edge_lock);
+   hrtimer_init(&chan->edge_flush_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+   chan->edge_flush_timer.function = &vwire_edge_flush_callback;
+   chan->rx_irq = -1;
+   INIT_WORK(&chan->decode_work, vwire_decode_work);
+
+   vw_init(ch, index);
+   ch->priv = chan;
+
+   if (!vw_set_samples_per_bit(ch, vwire_samples_per_bit[index])) {
+      printk(KERN_ERR VWIRE_DRV_NAME ": %s: %u samples per bit not supported\n",
+            chan->name, vwire_samples_per_bit[index]);
+      return -EINVAL;
+   }
+
+   /* the receive queue in pages of its own, so /dev can map it */
+   chan->rx_ring = vmalloc_user(PAGE_ALIGN(sizeof(*chan->rx_ring)));
+   if (!chan->rx_ring)
+      return -ENOMEM;
+   vw_set_rx_ring(ch, chan->rx_ring);
 
    /* init pins */
-   vw_set_tx_pin(vwire_tx_gpio);
-   vw_set_rx_pin(vwire_rx_gpio);
-   vw_set_ptt_pin(vwire_ptt_gpio);
-   vw_set_ptt_inverted(vwire_ptt_invert);
-   vw_set_led_pin(vwire_led_gpio);
+   vw_set_tx_pin(ch, vwire_tx_gpio[index]);
+   vw_set_rx_pin(ch, vwire_rx_gpio[index]);
+   vw_set_ptt_pin(ch, vwire_ptt_gpio[index]);
+   vw_set_ptt_inverted(ch, vwire_ptt_invert[index]);
+   vw_set_led_pin(ch, vwire_led_gpio[index]);
+   vw_set_rx_queue_len(ch, vwire_rx_queue_len);
+   vw_set_tx_queue_len(ch, vwire_tx_queue_len);
+   vw_set_rx_edge_mode(ch, vwire_rx_mode == VWIRE_RX_MODE_EDGE);
+   vw_set_tx_bit_time(ch, NSINSEC / vwire_baudrate);
+   vw_set_rx_dedup(ch, msecs_to_jiffies(min_t(unsigned int, vwire_dedup_ms, VWIRE_DEDUP_MS_MAX)));
+
+   vw_set_callbacks(ch, vwire_rx_done, vwire_tx_done);
+   vw_set_rx_timestamp(ch, vwire_rx_timestamp);
+   vw_set_rx_tap(ch, vwire_capture_tap, vwire_capture_event);
+   vwire_decode_setup(chan);
+
+   /* the other rates take over the callbacks, so after them */
+   err = vwire_rates_init(chan);
+   if (err) goto fail_fs_init;
+
+   /* the receive attribute reads through vw_get_message()'s cursor */
+   err = vwire_reader_init(&chan->reader, chan, &ch->rx_reader);
+   if (err) goto fail_fs_init;
 
    /* set up sysfs */
-   err = vwire_fs_init();
+   err = vwire_fs_init(chan);
    if (err) goto fail_fs_init;
 
    /* call setup */
-   err = vw_setup();
+   err = vw_setup(ch);
    if (err) goto fail_setup;
 
-   /* start the sample loop */
-   ktime = ktime_set(0, DelayFromBaudrate(vwire_baudrate));
+   if (vwire_rx_mode == VWIRE_RX_MODE_EDGE) {
+      err = vwire_edge_init(chan);
+      if (err) goto fail_edge;
+   }
+
+   /* and let userspace at it */
+   chan->misc.minor = MISC_DYNAMIC_MINOR;
+   chan->misc.name = chan->name;
+   chan->misc.fops = &vwire_dev_fops;
+   err = misc_register(&chan->misc);
+   if (err) goto fail_misc;
+
+   if (vwire_netdev) {
+      err = vwire_net_init(chan);
+      if (err) goto fail_net;
+   }
+
+   printk(KERN_INFO VWIRE_DRV_NAME 
+         ": %s: tx_gpio %d, rx_gpio %d, ptt_gpio %d, led_gpio %d, ptt_invert %d\n",
+         chan->name, vwire_tx_gpio[index], vwire_rx_gpio[index], vwire_ptt_gpio[index],
+         vwire_led_gpio[index], vwire_ptt_invert[index]);
+   return 0;  /* success */
+
+fail_net:
+   printk(KERN_INFO VWIRE_DRV_NAME ": %s: unrolling network interface\n", chan->name);
+   misc_deregister(&chan->misc);
+fail_misc:
+   printk(KERN_INFO VWIRE_DRV_NAME ": %s: unrolling /dev/%s\n", chan->name, chan->name);
+fail_edge:
+   if (vwire_rx_mode == VWIRE_RX_MODE_EDGE) {
+      printk(KERN_INFO VWIRE_DRV_NAME ": %s: unrolling rx edge interrupt setup\n", chan->name);
+      vwire_edge_cleanup(chan);
+   }
+   vw_shutdown(ch);
+fail_setup:
+   printk(KERN_INFO VWIRE_DRV_NAME ": %s: unrolling vw_setup()\n", chan->name);
+fail_fs_init:
+   printk(KERN_INFO VWIRE_DRV_NAME ": %s: unrolling sysfs init\n", chan->name);
+   vwire_fs_cleanup(chan);
+   vwire_reader_cleanup(&chan->reader);
+   vw_set_rx_ring(ch, NULL);
+   vwire_rates_cleanup(chan);
+   vfree(chan->rx_ring);
+   chan->rx_ring = NULL;
+
+   return err;
+}
+
+/* Undo vwire_chan_init() once /dev/<name> is gone and the sample timer
+ * has stopped */
+static void vwire_chan_cleanup(struct vwire_chan *chan)
+{
+   cancel_work_sync(&chan->decode_work);
+
+   if (vwire_rx_mode == VWIRE_RX_MODE_EDGE)
+      vwire_edge_cleanup(chan);
+
+   vw_shutdown(&chan->vw);
+   vwire_fs_cleanup(chan);
+   vwire_reader_cleanup(&chan->reader);
+   vwire_net_cleanup(chan);
+
+   /* the sample timer is stopped, nothing can be using it any more */
+   kfree(vw_set_rx_filter(&chan->vw, NULL));
+
+   /* a mapping holds on to its pages, they go when it does */
+   vw_set_rx_ring(&chan->vw, NULL);
+   vwire_rates_cleanup(chan);
+   vfree(chan->rx_ring);
+   chan->rx_ring = NULL;
+}
+
+static int __init vwire_init_module(void)
+{
+   int err = 0;
+   ktime_t ktime;
+   unsigned int i;
+
+   printk(KERN_INFO VWIRE_DRV_NAME ": %s\n", __func__);
+
+   /* userspace sees the mapped receive ring as struct vwire_rx_ring */
+   BUILD_BUG_ON(offsetof(struct vw_rx_ring, frame) != offsetof(struct vwire_rx_ring, slot));
+   BUILD_BUG_ON(sizeof(struct vw_rx_frame) != sizeof(struct vwire_rx_slot));
+   BUILD_BUG_ON(offsetof(struct vw_rx_frame, meta.time_ns) != offsetof(struct vwire_rx_slot, ts_ns));
+   BUILD_BUG_ON(offsetof(struct vw_rx_frame, meta.baud) != offsetof(struct vwire_rx_slot, baud));
+   BUILD_BUG_ON(offsetof(struct vw_rx_frame, len) != offsetof(struct vwire_rx_slot, len));
+   BUILD_BUG_ON(offsetof(struct vw_rx_frame, buf) != offsetof(struct vwire_rx_slot, data));
+   BUILD_BUG_ON(VW_RX_QUEUE_MAX != VWIRE_RX_RING_SLOTS_MAX);
+
+   /* decode and CRC tables, before any channel can receive */
+   vw_codec_init();
+
+   /* one channel for each pin given, at least one */
+   vwire_num_chans = max3(vwire_tx_gpio_num, vwire_rx_gpio_num, 1);
+   vwire_baudrate = Limit(vwire_baudrate, BAUD_MIN, BAUD_MAX);
+   vwire_decode_us = Limit(vwire_decode_us, VWIRE_DECODE_US_MIN, VWIRE_DECODE_US_MAX);
+
+   device_class = class_create(THIS_MODULE, VWIRE_DEV_NAME);
+   if (IS_ERR(device_class))
+      return PTR_ERR(device_class);
+
    hrtimer_init(&vwire_sample_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
    vwire_sample_timer.function = &vwire_sample_timer_callback;
-   err = hrtimer_start(&vwire_sample_timer, ktime, HRTIMER_MODE_REL);
-   if (err) goto fail_timer;
+
+   /* debug files are optional, errors here are not fatal */
+   vwire_debugfs_dir = debugfs_create_dir(VWIRE_DRV_NAME, NULL);
+   vwire_timing_init(vwire_debugfs_dir);
+   vwire_capture_init(vwire_debugfs_dir);
+
+   /* the pin attributes appear before the channels are complete */
+   mutex_lock(&vwire_cfg_lock);
+   for (i = 0; i < vwire_num_chans; i++) {
+      err = vwire_chan_init(&vwire_chans[i], i);
+      if (err) break;
+   }
+   mutex_unlock(&vwire_cfg_lock);
+   if (err) goto fail_chan;
+
+   /* the sample timer has to keep up with the most oversampled channel */
+   vwire_update_ticks();
+   err = vwire_check_rate(vwire_baudrate, vwire_tick_spb);
+   if (err) goto fail_chan;
+
+   /* start the sample loop, in edge mode only when there is something to send */
+   if (vwire_rx_mode != VWIRE_RX_MODE_EDGE) {
+      ktime = ktime_set(0, vwire_sample_ns(vwire_tick_spb));
+      hrtimer_start(&vwire_sample_timer, ktime, HRTIMER_MODE_REL);
+   }
 
    /* start receiving */
-   vw_rx_start();
+   for (i = 0; i < vwire_num_chans; i++) {
+      if (vwire_chans[i].vw.receiver.label)
+         vw_rx_start(&vwire_chans[i].vw);
+   }
+
+   err = class_create_file(device_class, &class_attr_baudrate);
+   if (err) goto fail_class_file;
 
    printk(KERN_INFO VWIRE_DRV_NAME 
-         ": VirualWire started: baudrate %d, vwire_tx_gpio %d, vwire_rx_gpio %d, vwire_ptt_gpio %d, vwire_led_gpio %d, vwire_ptt_invert %d, vwire_verbose %d \n",
-         vwire_baudrate, vwire_tx_gpio, vwire_rx_gpio, vwire_ptt_gpio, vwire_led_gpio, vwire_ptt_invert, vwire_verbose);
+         ": VirualWire started: %u channels, baudrate %d, vwire_rx_mode %d, vwire_verbose %d \n",
+         vwire_num_chans, vwire_baudrate, vwire_rx_mode, vwire_verbose);
    return 0;  /* success */
 
-fail_timer:
+fail_class_file:
    printk(KERN_INFO VWIRE_DRV_NAME ": unrolling highres timer setup\n");
-fail_setup:
-   printk(KERN_INFO VWIRE_DRV_NAME ": unrolling vw_setup()\n");
-fail_fs_init:
-   printk(KERN_INFO VWIRE_DRV_NAME ": unrolling sysfs init\n");
-   vwire_fs_cleanup();
+   hrtimer_cancel(&vwire_sample_timer);
+fail_chan:
+   printk(KERN_INFO VWIRE_DRV_NAME ": unrolling channels\n");
+   while (i--) {
+      vwire_net_remove(&vwire_chans[i]);
+      misc_deregister(&vwire_chans[i].misc);
+      vwire_chan_cleanup(&vwire_chans[i]);
+   }
+   vwire_capture_cleanup();
+   debugfs_remove_recursive(vwire_debugfs_dir);
+   class_destroy(device_class);
 
    return err;
 }
@@ -261,22 +2108,33 @@ fail_fs_init:
 static void __exit vwire_cleanup_module(void)
 {
    int ret;
+   unsigned int i;
 
    printk(KERN_INFO VWIRE_DRV_NAME ": %s\n", __func__);
 
-   vw_shutdown();
-   vwire_fs_cleanup();  
+   /* no new messages can be queued and nothing reconfigured once the 
+    * /dev nodes and sysfs files are gone */
+   class_remove_file(device_class, &class_attr_baudrate);
+   for (i = 0; i < vwire_num_chans; i++) {
+      vwire_net_remove(&vwire_chans[i]);
+      misc_deregister(&vwire_chans[i].misc);
+      vwire_fs_cleanup(&vwire_chans[i]);
+      vw_rx_stop(&vwire_chans[i].vw);
+   }
 
    /* cancel timer */
    ret = hrtimer_cancel(&vwire_sample_timer);
    if (ret) printk(KERN_INFO VWIRE_DRV_NAME ": The timer was still in use...\n");
 
+   for (i = 0; i < vwire_num_chans; i++)
+      vwire_chan_cleanup(&vwire_chans[i]);
+
+   vwire_capture_cleanup();
+   debugfs_remove_recursive(vwire_debugfs_dir);
+   class_destroy(device_class);
+
    return;
 }
 
 module_init(vwire_init_module);
 module_exit(vwire_cleanup_module);
-
-
-
-
@@ -0,0 +1,50 @@
+// vwire_port.c
+//
+// Userspace side of vwire_port.h: routes the GPIO calls of the protocol
+// core to the ops set by vw_port_set_gpio_ops(). Not part of the module.
+// GPL2
+
+#include <time.h>
+
+#include "vwire_port.h"
+
+static const struct vw_port_gpio_ops *vw_port_ops;
+
+void vw_port_set_gpio_ops(const struct vw_port_gpio_ops *ops)
+{
+   vw_port_ops = ops;
+}
+
+unsigned long vw_port_jiffies(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
+int gpio_request_one(unsigned gpio, unsigned long flags, const char *label)
+{
+   if (vw_port_ops && vw_port_ops->request)
+      return vw_port_ops->request(vw_port_ops->ctx, gpio, flags, label);
+   return 0;
+}
+
+void gpio_free(unsigned gpio)
+{
+   if (vw_port_ops && vw_port_ops->free)
+      vw_port_ops->free(vw_port_ops->ctx, gpio);
+}
+
+int gpio_get_value(unsigned gpio)
+{
+   if (vw_port_ops && vw_port_ops->get)
+      return vw_port_ops->get(vw_port_ops->ctx, gpio);
+   return 0;
+}
+
+void gpio_set_value(unsigned gpio, int value)
+{
+   if (vw_port_ops && vw_port_ops->set)
+      vw_port_ops->set(vw_port_ops->ctx, gpio, value);
+}
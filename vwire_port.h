@@ -0,0 +1,124 @@
+// vwire_port.h
+//
+// What the Virtual Wire protocol core (vwire.c, vwire_codec.c) needs from
+// its environment. In the kernel these are the usual kernel headers,
+// outside it a small userspace equivalent, so the core can be built into
+// libvwire.a and run off-target.
+//
+// In userspace the GPIO calls go to a pluggable sample source/sink set
+// with vw_port_set_gpio_ops(), keyed by the pin numbers given to the
+// vw_set_*_pin() functions.
+// GPL2
+
+#ifndef vwire_port_h
+#define vwire_port_h
+
+#ifdef __KERNEL__
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/gpio.h>
+#include <linux/bitops.h>
+#include <linux/jiffies.h>
+#include <linux/rcupdate.h>
+#include <linux/u64_stats_sync.h>
+
+#include "vwire_trace.h"
+#include "vwire_capture.h"
+
+// Only tap the receiver while vwire_capture.c has a capture armed
+#define vw_rx_tapped(ch)      (static_branch_unlikely(&vwire_capture_enabled) && (ch)->rx_tap)
+
+#else  // userspace
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+
+#define KERN_ERR     ""
+#define KERN_INFO    ""
+#define KERN_DEBUG   ""
+#define printk(...)  fprintf(stderr, __VA_ARGS__)
+
+#define READ_ONCE(x)          (*(const volatile __typeof__(x) *)&(x))
+#define WRITE_ONCE(x, val)    (*(volatile __typeof__(x) *)&(x) = (val))
+#define smp_load_acquire(p)   __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define smp_store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define smp_mb()              __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define smp_wmb()             __atomic_thread_fence(__ATOMIC_RELEASE)
+#define smp_rmb()             __atomic_thread_fence(__ATOMIC_ACQUIRE)
+
+// A channel runs in one thread, but the pointer is still published safely
+#define __rcu
+#define rcu_dereference_sched(p)          __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define rcu_dereference_protected(p, c)   (p)
+#define rcu_assign_pointer(p, v)          __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+#define hweight32(w)          __builtin_popcount(w)
+#define __ffs(w)              __builtin_ctzl(w)
+
+// Milliseconds of the monotonic clock, what vw_wait_rx_max() counts in
+#define jiffies               vw_port_jiffies()
+extern unsigned long vw_port_jiffies(void);
+
+// The userspace build runs a channel from one thread, nothing to guard
+struct u64_stats_sync
+{
+   char unused;
+};
+
+static inline void u64_stats_init(struct u64_stats_sync *syncp) {}
+static inline void u64_stats_update_begin(struct u64_stats_sync *syncp) {}
+static inline void u64_stats_update_end(struct u64_stats_sync *syncp) {}
+static inline unsigned int u64_stats_fetch_begin(const struct u64_stats_sync *syncp) { return 0; }
+static inline bool u64_stats_fetch_retry(const struct u64_stats_sync *syncp, unsigned int start) { return false; }
+
+// No tracing outside the kernel, see vwire_trace.h for the events
+#define trace_vwire_rx_start(...)          do { } while (0)
+#define trace_vwire_rx_byte(...)           do { } while (0)
+#define trace_vwire_rx_length_reject(...)  do { } while (0)
+#define trace_vwire_rx_symbol_reject(...)  do { } while (0)
+#define trace_vwire_rx_frame(...)          do { } while (0)
+#define trace_vwire_rx_crc(...)            do { } while (0)
+#define trace_vwire_tx_start(...)          do { } while (0)
+#define trace_vwire_tx_stop(...)           do { } while (0)
+#define trace_vwire_ptt(...)               do { } while (0)
+
+#define vw_rx_tapped(ch)      ((ch)->rx_tap != NULL)
+
+// Same flag values as the kernel's legacy GPIO interface
+#define GPIOF_IN              (1 << 0)
+#define GPIOF_OUT_INIT_LOW    (0)
+#define GPIOF_OUT_INIT_HIGH   (1 << 1)
+
+struct gpio
+{
+   unsigned gpio;
+   unsigned long flags;
+   const char *label;
+};
+
+/// Where the pins of the userspace build go. Any of the functions can be
+/// NULL: requests then succeed, reads return 0 and writes are dropped
+struct vw_port_gpio_ops
+{
+   int  (*request)(void *ctx, unsigned gpio, unsigned long flags, const char *label);
+   void (*free)(void *ctx, unsigned gpio);
+   int  (*get)(void *ctx, unsigned gpio);
+   void (*set)(void *ctx, unsigned gpio, int value);
+   void *ctx;
+};
+
+/// Route the GPIO calls of the protocol core, NULL for none
+extern void vw_port_set_gpio_ops(const struct vw_port_gpio_ops *ops);
+
+extern int  gpio_request_one(unsigned gpio, unsigned long flags, const char *label);
+extern void gpio_free(unsigned gpio);
+extern int  gpio_get_value(unsigned gpio);
+extern void gpio_set_value(unsigned gpio, int value);
+
+#endif  // __KERNEL__
+
+#endif
@@ -0,0 +1,132 @@
+/*
+ * VirtualWire kernel driver
+ *
+ * Sample loop timing instrumentation, see vwire_timing.h.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/atomic.h>
+#include <linux/bitops.h>
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <linux/seq_file.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+
+#include "vwire_config.h"
+#include "vwire_timing.h"
+
+DEFINE_STATIC_KEY_FALSE(vwire_timing_enabled);
+
+/* Only the sample timer callback writes these, and it never runs on two
+ * CPUs at once.  A reader racing with it may be off by a tick, which is 
+ * fine for a histogram. */
+static unsigned long    vwire_timing_ticks;
+static unsigned long    vwire_timing_late[VWIRE_TIMING_BUCKETS];
+static unsigned long    vwire_timing_run[VWIRE_TIMING_BUCKETS];
+
+/* counted whether or not the histograms are enabled */
+static atomic64_t       vwire_timing_missed_ticks = ATOMIC64_INIT(0);
+
+static unsigned int vwire_timing_bucket(ktime_t t)
+{
+   s64 ns = ktime_to_ns(t);
+
+   if (ns <= 0)
+      return 0;
+   return min_t(unsigned int, fls64(ns), VWIRE_TIMING_BUCKETS - 1);
+}
+
+void vwire_timing_record(ktime_t late, ktime_t run)
+{
+   vwire_timing_ticks++;
+   vwire_timing_late[vwire_timing_bucket(late)]++;
+   vwire_timing_run[vwire_timing_bucket(run)]++;
+}
+
+void vwire_timing_missed(u64 missed)
+{
+   atomic64_add(missed, &vwire_timing_missed_ticks);
+}
+
+static void vwire_timing_reset(void)
+{
+   vwire_timing_ticks = 0;
+   memset(vwire_timing_late, 0, sizeof(vwire_timing_late));
+   memset(vwire_timing_run, 0, sizeof(vwire_timing_run));
+   atomic64_set(&vwire_timing_missed_ticks, 0);
+}
+
+static void vwire_timing_show_hist(struct seq_file *m, const char *name, 
+                                   const unsigned long *hist)
+{
+   unsigned int i;
+
+   seq_printf(m, "%s:\n", name);
+   for (i = 0; i < VWIRE_TIMING_BUCKETS; i++) {
+      if (hist[i] == 0)
+         continue;
+      if (i == VWIRE_TIMING_BUCKETS - 1)
+         seq_printf(m, "  %10llu and up     %lu\n", 1ULL << (i - 1), hist[i]);
+      else
+         seq_printf(m, "  %10llu..%-10llu %lu\n", 
+               i ? 1ULL << (i - 1) : 0ULL, (1ULL << i) - 1, hist[i]);
+   }
+}
+
+static int vwire_timing_show(struct seq_file *m, void *v)
+{
+   seq_printf(m, "enabled %d\n", static_key_enabled(&vwire_timing_enabled) ? 1 : 0);
+   seq_printf(m, "ticks %lu\n", vwire_timing_ticks);
+   seq_printf(m, "missed %lld\n", (long long)atomic64_read(&vwire_timing_missed_ticks));
+   vwire_timing_show_hist(m, "late_ns", vwire_timing_late);
+   vwire_timing_show_hist(m, "run_ns", vwire_timing_run);
+   return 0;
+}
+
+static int vwire_timing_open(struct inode *inode, struct file *file)
+{
+   return single_open(file, vwire_timing_show, NULL);
+}
+
+/* "1" starts collecting, "0" stops, "reset" clears the histograms */
+static ssize_t vwire_timing_write(struct file *file, const char __user *ubuf,
+                                  size_t count, loff_t *ppos)
+{
+   char buf[8];
+
+   if (count >= sizeof(buf))
+      return -EINVAL;
+   if (copy_from_user(buf, ubuf, count))
+      return -EFAULT;
+   buf[count] = '\0';
+
+   if (sysfs_streq(buf, "1"))
+      static_branch_enable(&vwire_timing_enabled);
+   else if (sysfs_streq(buf, "0"))
+      static_branch_disable(&vwire_timing_enabled);
+   else if (sysfs_streq(buf, "reset"))
+      vwire_timing_reset();
+   else
+      return -EINVAL;
+
+   return count;
+}
+
+static const struct file_operations vwire_timing_fops = {
+   .owner   = THIS_MODULE,
+   .open    = vwire_timing_open,
+   .read    = seq_read,
+   .write   = vwire_timing_write,
+   .llseek  = seq_lseek,
+   .release = single_release,
+};
+
+void vwire_timing_init(struct dentry *dir)
+{
+   debugfs_create_file("timing", S_IRUSR | S_IWUSR, dir, NULL, &vwire_timing_fops);
+}
@@ -0,0 +1,32 @@
+/*
+ * VirtualWire kernel driver
+ *
+ * Timing of the sample loop: how late each tick of the sample timer ran,
+ * how long the protocol handlers took and how many ticks were missed.
+ * Kept in log2 histograms, read and switched through debugfs vwire/timing.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation.
+ */
+
+#ifndef vwire_timing_h
+#define vwire_timing_h
+
+#include <linux/jump_label.h>
+#include <linux/ktime.h>
+
+/* bucket n counts values of 2^(n-1) up to 2^n - 1 ns, the last one the rest */
+#define VWIRE_TIMING_BUCKETS  (32)
+
+/* off by default, the sample loop then only pays for a patched-out branch */
+DECLARE_STATIC_KEY_FALSE(vwire_timing_enabled);
+
+/* one tick of the sample timer: lateness of the wakeup and time spent */
+extern void vwire_timing_record(ktime_t late, ktime_t run);
+
+/* ticks the timer had to skip, hrtimer_forward_now() overruns beyond 1 */
+extern void vwire_timing_missed(u64 missed);
+
+extern void vwire_timing_init(struct dentry *dir);
+
+#endif
@@ -0,0 +1,163 @@
+/*
+ * VirtualWire kernel driver
+ *
+ * Trace events of the protocol core, so the receiver and transmitter can
+ * be followed with ftrace or perf without disturbing the sample timing:
+ *
+ *   echo 1 > /sys/kernel/tracing/events/vwire/enable
+ *   cat /sys/kernel/tracing/trace_pipe
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM vwire
+
+#if !defined(_VWIRE_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _VWIRE_TRACE_H
+
+#include <linux/tracepoint.h>
+
+DECLARE_EVENT_CLASS(vwire_chan_event,
+   TP_PROTO(u8 chan),
+   TP_ARGS(chan),
+   TP_STRUCT__entry(
+      __field(u8, chan)
+   ),
+   TP_fast_assign(
+      __entry->chan = chan;
+   ),
+   TP_printk("chan=%u", __entry->chan)
+);
+
+/* the start symbol was seen, a message follows */
+DEFINE_EVENT(vwire_chan_event, vwire_rx_start,
+   TP_PROTO(u8 chan),
+   TP_ARGS(chan)
+);
+
+/* the transmitter went idle */
+DEFINE_EVENT(vwire_chan_event, vwire_tx_stop,
+   TP_PROTO(u8 chan),
+   TP_ARGS(chan)
+);
+
+/* one byte decoded, index 0 is the byte count */
+TRACE_EVENT(vwire_rx_byte,
+   TP_PROTO(u8 chan, u8 index, u8 byte),
+   TP_ARGS(chan, index, byte),
+   TP_STRUCT__entry(
+      __field(u8, chan)
+      __field(u8, index)
+      __field(u8, byte)
+   ),
+   TP_fast_assign(
+      __entry->chan = chan;
+      __entry->index = index;
+      __entry->byte = byte;
+   ),
+   TP_printk("chan=%u index=%u byte=0x%02x", __entry->chan, __entry->index, __entry->byte)
+);
+
+/* the message was dropped for a byte count out of range */
+TRACE_EVENT(vwire_rx_length_reject,
+   TP_PROTO(u8 chan, u8 count),
+   TP_ARGS(chan, count),
+   TP_STRUCT__entry(
+      __field(u8, chan)
+      __field(u8, count)
+   ),
+   TP_fast_assign(
+      __entry->chan = chan;
+      __entry->count = count;
+   ),
+   TP_printk("chan=%u count=%u", __entry->chan, __entry->count)
+);
+
+/* the message was dropped for an invalid 6 bit symbol */
+TRACE_EVENT(vwire_rx_symbol_reject,
+   TP_PROTO(u8 chan, u8 index, u16 bits),
+   TP_ARGS(chan, index, bits),
+   TP_STRUCT__entry(
+      __field(u8, chan)
+      __field(u8, index)
+      __field(u16, bits)
+   ),
+   TP_fast_assign(
+      __entry->chan = chan;
+      __entry->index = index;
+      __entry->bits = bits;
+   ),
+   TP_printk("chan=%u index=%u bits=0x%03x", __entry->chan, __entry->index, __entry->bits)
+);
+
+/* all bytes of a message are in */
+TRACE_EVENT(vwire_rx_frame,
+   TP_PROTO(u8 chan, u8 len),
+   TP_ARGS(chan, len),
+   TP_STRUCT__entry(
+      __field(u8, chan)
+      __field(u8, len)
+   ),
+   TP_fast_assign(
+      __entry->chan = chan;
+      __entry->len = len;
+   ),
+   TP_printk("chan=%u len=%u", __entry->chan, __entry->len)
+);
+
+/* FCS check of a complete message, crc is 0xf0b8 when it is good */
+TRACE_EVENT(vwire_rx_crc,
+   TP_PROTO(u8 chan, u16 crc, bool ok),
+   TP_ARGS(chan, crc, ok),
+   TP_STRUCT__entry(
+      __field(u8, chan)
+      __field(u16, crc)
+      __field(bool, ok)
+   ),
+   TP_fast_assign(
+      __entry->chan = chan;
+      __entry->crc = crc;
+      __entry->ok = ok;
+   ),
+   TP_printk("chan=%u crc=0x%04x %s", __entry->chan, __entry->crc, __entry->ok ? "ok" : "bad")
+);
+
+/* a message starts going out, len in 6 bit symbols with the header */
+TRACE_EVENT(vwire_tx_start,
+   TP_PROTO(u8 chan, u8 len),
+   TP_ARGS(chan, len),
+   TP_STRUCT__entry(
+      __field(u8, chan)
+      __field(u8, len)
+   ),
+   TP_fast_assign(
+      __entry->chan = chan;
+      __entry->len = len;
+   ),
+   TP_printk("chan=%u len=%u", __entry->chan, __entry->len)
+);
+
+/* the PTT line was switched, on means transmitting whatever its polarity */
+TRACE_EVENT(vwire_ptt,
+   TP_PROTO(u8 chan, bool on),
+   TP_ARGS(chan, on),
+   TP_STRUCT__entry(
+      __field(u8, chan)
+      __field(bool, on)
+   ),
+   TP_fast_assign(
+      __entry->chan = chan;
+      __entry->on = on;
+   ),
+   TP_printk("chan=%u %s", __entry->chan, __entry->on ? "on" : "off")
+);
+
+#endif /* _VWIRE_TRACE_H */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#define TRACE_INCLUDE_FILE vwire_trace
+#include <trace/define_trace.h>
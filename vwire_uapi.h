@@ -0,0 +1,116 @@
+/*
+ * VirtualWire kernel driver
+ *
+ * ioctls of /dev/vwire, /dev/vwire1, ...  Shared by the module and the 
+ * programs using it, so only uapi types in here.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation.
+ */
+
+#ifndef vwire_uapi_h
+#define vwire_uapi_h
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define VWIRE_IOC_MAGIC       (0xb7)
+
+/* messages this open file missed because it fell more than the receive 
+ * queue behind, every open file counts its own */
+#define VWIRE_IOC_RX_DROPPED  _IOR(VWIRE_IOC_MAGIC, 1, __u32)
+
+/* what read() returns for each message, one of VWIRE_RX_FORMAT_*, for 
+ * this open file only */
+#define VWIRE_IOC_SET_RX_FORMAT  _IOW(VWIRE_IOC_MAGIC, 2, __u32)
+
+#define VWIRE_RX_FORMAT_PAYLOAD  (0)  /* the message bytes, the default */
+#define VWIRE_RX_FORMAT_RECORD   (1)  /* a struct vwire_rx_record, then the bytes */
+
+/* In VWIRE_RX_FORMAT_RECORD each read() returns one of these followed by
+ * len bytes of message.  A read shorter than the record fails with 
+ * EINVAL, a longer one that can not take the whole message truncates it. */
+struct vwire_rx_record {
+   __u64 ts_ns;      /* CLOCK_MONOTONIC start of the start symbol */
+   __u16 len;        /* message bytes following the record */
+   __u8  flags;      /* VWIRE_RX_* */
+   __u8  quality;    /* 255 transitions on time ... 0 half a bit off, see README */
+   __u16 baud;       /* rate it was decoded at, see vwire_rx_rates */
+   __u16 reserved;   /* 0 */
+};
+
+#define VWIRE_RX_CRC_OK          (1 << 0)  /* the checksum was good */
+#define VWIRE_RX_TRUNCATED       (1 << 1)  /* the buffer was too short for the message */
+
+/* Sleep until the receive ring holds a message numbered tail or later, 
+ * see struct vwire_rx_ring.  Sets where poll() and read() on this file 
+ * go on from.  Fails with EAGAIN under O_NONBLOCK if there is none yet. */
+#define VWIRE_IOC_RX_WAIT        _IOW(VWIRE_IOC_MAGIC, 3, __u32)
+
+/* One message in the receive ring */
+struct vwire_rx_slot {
+   __u32 gen;        /* odd while the slot is being written */
+   __u32 seq;        /* number of the message in it */
+   __u64 ts_ns;      /* as in struct vwire_rx_record */
+   __u8  crc_ok;     /* the checksum was good */
+   __u8  quality;    /* as in struct vwire_rx_record */
+   __u16 baud;       /* as in struct vwire_rx_record */
+   __u8  pad0[4];
+   __u8  len;        /* bytes in data: byte count, message, 2 checksum bytes */
+   __u8  data[30];   /* the message is data[1] to data[len - 3] */
+   __u8  pad1;
+};
+
+/* The receive queue, as mmap() of the device maps it read only, with
+ * offset 0 and at most VWIRE_RX_RING_BYTES long.  The driver writes every
+ * message once, however many processes read it, and never waits for 
+ * them: each keeps its own tail, the number of the next message it wants.
+ * To take message tail:
+ *
+ *    head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+ *    if (head == tail)
+ *       nothing new, ioctl(fd, VWIRE_IOC_RX_WAIT, &tail) sleeps until there is;
+ *    if (head - tail > ring->len)
+ *       lost head - tail - ring->len messages, tail = head - ring->len;
+ *    slot = &ring->slot[tail & (ring->len - 1)];
+ *    gen = __atomic_load_n(&slot->gen, __ATOMIC_ACQUIRE);
+ *    if gen is even and slot->seq == tail, use the slot in place, then
+ *    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+ *    if slot->gen is still gen, what was used was good, else it was
+ *    overwritten meanwhile and is lost;
+ *    tail++;
+ */
+struct vwire_rx_ring {
+   __u32 head;       /* number of the next message to be written */
+   __u32 len;        /* slots in use, a power of 2 */
+   struct vwire_rx_slot slot[];
+};
+
+#define VWIRE_RX_RING_SLOTS_MAX  (64)
+#define VWIRE_RX_RING_BYTES      (sizeof(struct vwire_rx_ring) \
+                                  + VWIRE_RX_RING_SLOTS_MAX * sizeof(struct vwire_rx_slot))
+
+/* debugfs vwire/capture streams captures of the raw receiver samples, 
+ * each one of these followed by words __u32 of samples, 32 to a word with
+ * the oldest in bit 0, just as the PLL took them.  Run through 
+ * vw_pll_word() of a channel with the same samples per bit they decode 
+ * to what the receiver got.  A debugging aid, not a stable interface. */
+struct vwire_capture_hdr {
+   __u32 magic;      /* VWIRE_CAPTURE_MAGIC */
+   __u8  chan;       /* channel number */
+   __u8  trigger;    /* the VWIRE_CAPTURE_* event that started it */
+   __u8  spb;        /* samples per bit */
+   __u8  reserved0;
+   __u32 words;      /* words of samples following */
+   __u32 trigger_at; /* samples taken up to the trigger */
+   __u64 ts_ns;      /* CLOCK_MONOTONIC of the first sample */
+   __u32 sample_ns;  /* time between two samples */
+   __u32 reserved1;
+};
+
+#define VWIRE_CAPTURE_MAGIC      (0x76774370)
+
+#define VWIRE_CAPTURE_START      (1 << 0)  /* the start symbol was seen */
+#define VWIRE_CAPTURE_REJECT     (1 << 1)  /* a message had an impossible length */
+
+#endif